@@ -2,12 +2,31 @@
 #define _9CC_H_
 
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// 出力するアセンブリの形式。macOSではMach-O向けにシンボルの先頭に_を付け、
+// それ以外ではELF向けにそのままの名前で出力する
+#ifdef __APPLE__
+#define SYM_PREFIX "_"
+#else
+#define SYM_PREFIX ""
+#endif
+
+// グローバル変数を参照するときの名前。ELFではgsのようにレジスタと同じ名前の
+// 変数をアセンブラがレジスタと取り違えるので、定義の位置に置いた
+// .L.gvar.で始まる別名で参照する。Mach-Oでは_が付くので取り違えない
+#ifdef __APPLE__
+#define GVAR_PREFIX "_"
+#else
+#define GVAR_PREFIX ".L.gvar."
+#endif
+
 // 抽象構文木のノードの種類
 typedef enum {
   ND_ADD,      // +
@@ -21,7 +40,16 @@ typedef enum {
   ND_NE,       // !=
   ND_LE,       // <=
   ND_LT,       // <
-  ND_ASSIGN,   // =
+  ND_LOGAND,   // &&
+  ND_LOGOR,    // ||
+  ND_NOT,      // !
+  ND_ASSIGN,      // =
+  ND_ADD_ASSIGN,  // +=
+  ND_SUB_ASSIGN,  // -=
+  ND_MUL_ASSIGN,  // *=
+  ND_DIV_ASSIGN,  // /=
+  ND_POST_INC,    // 後置の++
+  ND_POST_DEC,    // 後置の--
   ND_LVAR,     // ローカル変数
   ND_GVAR,     // グローバル変数
   ND_RETURN,   // return
@@ -35,11 +63,15 @@ typedef enum {
   ND_ADDR,     // &
   ND_DEREF,    // *
   ND_DECL,     // 変数宣言
+  ND_SWITCH,   // switch
+  ND_CASE,     // caseとdefault
+  ND_BREAK,    // break
+  ND_MEMBER,   // 構造体のメンバ（.と->）
+  ND_DATA,     // .rodataに置くローカル配列の初期値
 } NodeKind;
 
 // トークンの種類
 typedef enum {
-  TK_RESERVED,  // 記号
   TK_IDENT,     // 識別子
   TK_NUM,       // 整数トークン
   TK_CHAR,      // 文字型(char)
@@ -52,6 +84,45 @@ typedef enum {
   TK_WHILE,     // while
   TK_INT,       // int
   TK_SIZEOF,    // sizeof
+  TK_SWITCH,    // switch
+  TK_CASE,      // case
+  TK_DEFAULT,   // default
+  TK_BREAK,     // break
+  TK_STRUCT,    // struct
+
+  // 記号。2文字の記号を先に並べる
+  TK_EQ,          // ==
+  TK_NE,          // !=
+  TK_GE,          // >=
+  TK_LE,          // <=
+  TK_LOGAND,      // &&
+  TK_LOGOR,       // ||
+  TK_ADD_ASSIGN,  // +=
+  TK_SUB_ASSIGN,  // -=
+  TK_MUL_ASSIGN,  // *=
+  TK_DIV_ASSIGN,  // /=
+  TK_INC,         // ++
+  TK_DEC,         // --
+  TK_ARROW,       // ->
+  TK_COMMA,       // ,
+  TK_PLUS,        // +
+  TK_MINUS,       // -
+  TK_STAR,        // *
+  TK_SLASH,       // /
+  TK_LPAREN,      // (
+  TK_RPAREN,      // )
+  TK_LT,          // <
+  TK_GT,          // >
+  TK_ASSIGN,      // =
+  TK_SEMI,        // ;
+  TK_COLON,       // :
+  TK_LBRACE,      // {
+  TK_RBRACE,      // }
+  TK_AMP,         // &
+  TK_LBRACKET,    // [
+  TK_RBRACKET,    // ]
+  TK_NOT,         // !
+  TK_DOT,         // .
 } TokenKind;
 
 typedef struct Node Node;
@@ -59,13 +130,38 @@ typedef struct Token Token;
 typedef struct LVar LVar;
 typedef struct GVar GVar;
 typedef struct Type Type;
+typedef struct Member Member;
+typedef struct StructTag StructTag;
 typedef struct Str_vec Str_vec;
+typedef struct VecLoop VecLoop;
+typedef struct CompilerContext CompilerContext;
 
 // 型定義
 struct Type {
-  enum { INT, PTR, ARRAY, CHAR } ty;
+  enum { INT, PTR, ARRAY, CHAR, STRUCT } ty;
   Type* ptr_to;
   size_t array_size;
+  Member* members;  // STRUCTのメンバ（宣言順）
+  int size;         // STRUCTのサイズ（末尾のパディングを含む）
+  int align;        // STRUCTのアラインメント（メンバの最大値）
+  bool incomplete;  // STRUCTの定義の途中で、まだ大きさが決まっていない
+};
+
+// 構造体のメンバ
+struct Member {
+  Member* next;
+  char* name;
+  int len;
+  Type* type;
+  int offset;  // 構造体の先頭からのオフセット
+};
+
+// 構造体のタグ（struct fooのfoo）
+struct StructTag {
+  StructTag* next;
+  char* name;
+  int len;
+  Type* type;
 };
 
 // ローカル変数の型
@@ -83,26 +179,44 @@ struct GVar {
   int len;     // 名前の長さ
   int offset;  // RBPからのオフセット
   Type* type;
+  Node** init;   // 初期値の要素。NULLなら0で初期化する
+  int init_len;  // 初期値の要素数
 };
 
 // トークン型
+// 入力全体を先にトークナイズして、ctx->tokensに連続した配列として並べる
 struct Token {
   TokenKind kind;  // トークンの型
-  Token* next;     // 次の入力トークン
   int val;         // kindがTK_NUMの場合、その数値
-  char* str;       // トークン文字列
+  int loc;         // 入力の先頭からのトークン文字列のオフセット
   int len;         // トークンの長さ
+  int line;        // 行番号（1から）
+  int col;         // 桁番号（1から）
 };
 
 // 抽象構文木のノードの型
 struct Node {
-  NodeKind kind;   // ノードの型
-  Node* lhs;       // 左辺
-  Node* rhs;       // 右辺
-  int val;         // kindがND_NUMの場合のみ使う
-  int offset;      // kindがND_LVARの場合のみ使う
-  char* funcname;  // 関数名
-  int str_label;   // 文字列リテラルのラベル番号（ND_STRの場合）
+  NodeKind kind;  // ノードの型
+  int line;       // ソース上の行番号（.locの出力用）
+  int col;        // ソース上の桁番号
+  Type* type;     // 型
+  Node* lhs;      // 左辺
+  Node* rhs;      // 右辺
+
+  // 種類ごとの値
+  union {
+    int val;         // ND_NUMとND_CASEの値
+    int str_label;   // ND_STR: 文字列リテラルのラベル番号
+    Member* member;  // ND_MEMBER: メンバ
+    struct {
+      char* funcname;  // ND_GVAR、ND_CALL、ND_FUNCの名前
+      int offset;      // ND_LVAR、ND_GVARのオフセット
+      int reg;         // 引数のND_LVAR: 値を置くレジスタの番号+1
+    };
+  };
+
+  // ここから下は文、関数呼び出し、関数定義のノードだけが持つ。
+  // 式のノードはここまでしか確保しない（is_compact()）
   struct {
     Node* cond;  // ifの条件式
     Node* then;  // 真の時
@@ -116,15 +230,76 @@ struct Node {
   int stmts_len;
   Node** params;   // ND_FUNCの引数リスト
   int params_len;  // 引数の数
-  Type* type;      // 型
+  int stack_size;  // ND_FUNCのローカル変数領域のサイズ
+  VecLoop* vec;    // ND_FORがベクトル化できる場合のみ使う
+  Node* case_next;     // ND_SWITCH: 最初のcase、ND_CASE: 次のcase
+  Node* default_case;  // ND_SWITCHのdefault
+  int label;           // ND_CASEのラベル番号
+
+  // プロファイル（-finstrument, -fprofile-use）
+  int branch_id;  // ND_IF: 関数内での番号、ND_FUNC: 関数内のifの数
+  long count;     // ND_FUNC: 呼び出し回数、ND_IF: 条件が真だった回数
+  long total;     // ND_IF: 条件を評価した回数
+};
+
+// ベクトル化できるループ
+//   for (i = A; i < n; i = i + 1) a[i] = b[i] + c[i];
+struct VecLoop {
+  Node* index;       // ループ変数 i
+  Node* limit;       // 終了値 n
+  bool inclusive;    // 条件が i <= n の場合
+  Node* dst;         // 書き込み先の配列（またはポインタ変数） a
+  Node* src[2];      // 読み出し元の配列、またはループ不変なスカラー b, c
+  bool is_array[2];  // src[i]が配列かどうか
+  int nsrc;          // 読み出し元の数（代入だけなら1）
+  NodeKind op;       // ND_ADD, ND_SUB, ND_MUL
+  int elem_size;     // 要素のサイズ（charなら1、intなら4）
 };
 
 typedef struct {
   Node** data;
   int capacity;
   int len;
+  bool in_arena;  // アリーナに確保した（伸ばすときもアリーナから取る）
 } Vector;
 
+// 関数1つ分の構文木などをまとめて確保し、まとめて解放する領域。
+// 大きなブロックをつなげたリストで、ブロックの中は先頭から順に使う
+typedef struct Arena Arena;
+struct Arena {
+  Arena* next;  // 前に確保したブロック
+  size_t size;  // dataの大きさ
+  size_t used;  // dataのうち使った大きさ
+  char data[];
+};
+
+// 演算子の優先順位。大きいほど強く結び付く
+enum {
+  PREC_NONE,        // 演算子ではない（開き括弧）
+  PREC_ASSIGN,      // = += -= *= /=（右結合）
+  PREC_LOGOR,       // ||
+  PREC_LOGAND,      // &&
+  PREC_EQUALITY,    // == !=
+  PREC_RELATIONAL,  // < <= > >=
+  PREC_ADD,         // + -
+  PREC_MUL,         // * /
+  PREC_UNARY,       // 前置の単項演算子
+};
+
+// 二項演算子の優先順位と作るノード
+typedef struct {
+  int prec;
+  NodeKind kind;
+  bool swap;  // 左右を入れ替える（a > bはb < aにする）
+} BinOp;
+
+// 式の構文解析で演算子のスタックに積むもの
+typedef struct {
+  TokenKind op;  // 演算子。TK_LPARENは括弧の始まり
+  int prec;      // 優先順位。前置の単項演算子はPREC_UNARY
+  Token* tok;    // 演算子の次のトークン
+} ExprOp;
+
 // 文字列リテラルを保存する構造体
 struct Str_vec {
   char* str;      // 文字列の内容
@@ -133,36 +308,98 @@ struct Str_vec {
   Str_vec* next;  // 次の文字列
 };
 
-// グローバル変数
-extern Token* token;
-extern char* user_input;
-extern Node* code[100];
-extern LVar* locals;
-extern GVar* globals;
-extern int label_number;
-extern Vector* stms;
-extern Str_vec* strings;  // 文字列リテラルのリスト
-extern char* filename;
+// 1回のコンパイルの状態。new_context()で作ってcompile()に渡す。
+// コンパイル中はスレッドごとのctxがこれを指す
+struct CompilerContext {
+  // 入力とオプション
+  char* filename;
+  char* user_input;
+  bool opt_avx2;  // -mavx2: AVX2命令でベクトル化する
+  bool opt_instrument;  // -finstrument: 関数ごとの呼び出しと時間を数える
+  char* profile_path;   // -fprofile-use: 計測結果のファイル
+
+  // 構文解析の状態
+  Token* tokens;     // トークンの配列。最後はTK_EOF
+  int ntokens;       // トークンの数
+  int tokens_cap;    // tokensに確保した要素数
+  int pos;           // 現在着目しているトークンの添え字
+  LVar* locals;      // 解析中の関数のローカル変数
+  GVar* globals;     // グローバル変数
+  Vector* funcs;     // 定義済みの関数（ND_FUNC）
+  Str_vec* strings;  // 文字列リテラルのリスト
+  StructTag* tags;   // 宣言された構造体のタグ
+  int nbranches;     // 解析中の関数のifの数
+  Node* cur_switch;  // 解析中のswitch文
+  int breakable;     // 解析中のループとswitchの入れ子の深さ
+  Vector* operands;  // 式の構文解析の被演算子のスタック
+  ExprOp* ops;       // 式の構文解析の演算子のスタック
+  int nops;          // opsに積んだ演算子の数
+  int ops_cap;       // opsに確保した要素数
+  Arena* arena;      // 関数の構文木とローカル変数を置くアリーナ
+  bool use_arena;    // 真の間はarena_alloc()がアリーナから確保する
+  bool has_profile;  // 計測結果を読み込んだ
+
+  // コード生成の状態
+  int label_number;
+  FILE* output;     // アセンブリの出力先
+  int func_index;   // 生成中の関数の番号（-finstrumentの計測表の添え字）
+  int prof_offset;  // 関数に入った時刻を保存するRBPからのオフセット
+  int branch_base;  // 生成中の関数の最初のifの、分岐の計測表の添え字
+  bool cold;        // ほとんど実行されないコードを生成中
+  FILE* cold_out;   // 関数の後ろに置くコードの出力先
+  int loc_line;     // 最後に.locで出力した行番号
+  int break_label;  // breakで飛ぶ.Lendの番号。ループとswitchの外では-1
+  FILE* rodata_out;  // ジャンプテーブルなど、最後に.rodataに置くデータ
+  char* rodata_buf;  // rodata_outに書いた内容
+  size_t rodata_len;
+  Node* func;        // 生成中の関数
+  int nsaved;        // 引数を置くために使うcallee-savedレジスタの数
+  int save_offset;   // それらのレジスタを退避するRBPからのオフセット
+  int depth;         // 関数本体でスタックに積んでいる値の数
+
+  // エラーが起きたときの戻り先とメッセージ
+  jmp_buf* on_error;
+  char* error;
+};
+
+extern _Thread_local CompilerContext* ctx;
+
+// compile.c
+CompilerContext* new_context(char* filename);
+void compile_functions();
+bool compile_to(CompilerContext* c, char* src, FILE* fp);
+char* compile(CompilerContext* c, char* src);
 
 // util.c
+void raise_error(char* msg);
 void error(char* fmt, ...);
 void error_at(char* loc, char* msg, ...);
 char* read_file(char* path);
+void* arena_alloc(size_t size);
+void arena_reset();
 Vector* new_vector();
 void vec_push(Vector* vec, Node* elem);
 
 // tokenizer.c
-Token* tokenize(char* p);
+extern char* punct_str[];
+void tokenize(char* p);
 
 // parse.c
-bool consume(char* op);
+Token* peek(int n);
+char* tok_str(Token* tok);
+char* node_str(Node* node);
+bool consume(TokenKind op);
 Token* consume_ident();
 bool consume_return();
 bool consume_if();
 bool consume_while();
 bool consume_for();
 bool consume_else();
-void expect(char* op);
+bool consume_switch();
+bool consume_case();
+bool consume_default();
+bool consume_break();
+void expect(TokenKind op);
 int expect_number();
 bool at_eof();
 void program();
@@ -171,23 +408,95 @@ GVar* find_gvar(Token* tok);
 Node* stmt();
 Node* expr();
 Node* assign();
-Node* equality();
-Node* relational();
-Node* add();
-Node* mul();
-Node* unary();
+Node* operand();
+void push_op(TokenKind op, int prec);
+void reduce(int base, int prec);
+Node* new_unary(TokenKind op, Node* lhs, Token* tok);
+Node* new_binop(TokenKind op, Node* lhs, Node* rhs, Token* tok);
+Node* postfix(Node* node);
+bool is_typename();
+StructTag* find_tag(Token* tok);
+Type* struct_decl();
+Node* struct_ref(Node* node);
+Type* array_suffix(Type* type);
+int read_char(char** p);
+Node** initializer(Type* type, int* len);
+Node* local_array_init(Node* var, Node** init, int len);
+bool is_const_expr(Node* node);
+long eval(Node* node);
+long eval_reloc(Node* node, char** label);
 Node* primary();
+bool is_compact(NodeKind kind);
 Node* new_node(NodeKind kind);
+void set_loc(Node* node, Token* tok);
 Node* new_binary(NodeKind kind, Node* lhs, Node* rhs);
 Node* new_node_num(int val);
 Node* top_level();
-Node* global_def(Token* tok);
-Node* function(Token* tok);
+Node* global_def(Token* tok, Type* type);
+Node* function(Token* tok, Type* type);
 Node* add_str_to_vec();
+Str_vec* find_str(char* p, int len);
+Node* find_func(char* name);
+Type* new_type(int ty, Type* ptr_to);
+LVar* new_lvar(Token* tok, Type* type);
+bool is_pointer(Type* type);
+bool is_struct(Type* type);
+bool is_incomplete(Type* type);
+Node* new_add(Node* lhs, Node* rhs);
+Node* new_sub(Node* lhs, Node* rhs);
+Node* new_compare(NodeKind kind, Node* lhs, Node* rhs);
+Node* new_logical(NodeKind kind, Node* lhs, Node* rhs);
+Node* new_assign(Node* lhs, Node* rhs);
+Node* new_assign_op(NodeKind kind, Node* lhs, Node* rhs);
+
+// profile.c
+void read_profile(char* path);
+
+// optimize.c
+void optimize(Node* func);
+void assign_param_regs(Node* func);
+
+// assemble.c
+void assemble(char* text, char* path);
+int run_jit(char* text, char** libs, int nlibs);
 
 // codegen.c
 void gen(Node* node);
+int var_reg(Node* node);
+void gen_stmt(Node* node);
+void gen_epilogue();
+bool is_assign_op(Node* node);
+bool var_operand(Node* node, char* buf);
+void gen_assign_op(Node* node, bool use_value);
+void gen_reg_assign_op(Node* node, bool use_value);
+bool is_simple_arg(Node* node);
+void gen_arg(Node* node, int i);
+void gen_call(Node* node);
+void gen_loc(Node* node);
+void gen_then(Node* node);
+void gen_body(Node* body, int lend);
+void gen_case_search(Node** cases, int lo, int hi, char* ldefault);
+void gen_switch(Node* node);
+void gen_prof_table(char* label, int size);
+void gen_prof_dump(Node** funcs, int nfuncs);
+void gen_begin();
+void gen_function(Node* func, int index, int branch_base);
+bool has_nul(Str_vec* str);
+void gen_string(FILE* fp, Str_vec* str);
+void gen_end();
+void gen_program();
 int size_of(Type* type);
+int align_of(Type* type);
+int align_to(int n, int align);
+void gen_push(char* fmt, ...);
+void gen_pop(char* reg);
 void gen_comment(const char* format, ...);
+void gen_load(Type* type);
+void gen_store(Node* lhs);
+void gen_data(FILE* fp, Type* type, Node** elems, int n);
+void gen_copy(int size);
+void gen_fill(int size, Node* val);
+bool gen_mem_builtin(Node* node);
+bool is_aggregate(Type* type);
 
 #endif
@@ -0,0 +1,1523 @@
+// mmapのMAP_ANONYMOUSを使うため
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+
+#include "9cc.h"
+
+// 9ccが出力したアセンブリを機械語に変換して、ELF64の再配置可能な
+// オブジェクトファイル（.o）を書き出す。外部のアセンブラを起動せずに
+// リンクできるようにするためのもので、9ccが出力する命令と
+// ディレクティブだけを扱う。--runでは同じ機械語をメモリ上に配置して
+// その場で実行する
+
+#ifdef __APPLE__
+
+void assemble(char* text, char* path) {
+  error("-cはELFのオブジェクトファイルを出力するため、macOSでは使えません");
+}
+
+int run_jit(char* text, char** libs, int nlibs) {
+  error("--runはELF向けのアセンブリを扱うため、macOSでは使えません");
+  return 1;
+}
+
+#else
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct Section Section;
+typedef struct Symbol Symbol;
+typedef struct Item Item;
+typedef struct Reloc Reloc;
+
+// 出力するセクション
+struct Section {
+  char* name;
+  int type;     // SHT_PROGBITS, SHT_NOBITS
+  int flags;    // SHF_ALLOC, SHF_WRITE, SHF_EXECINSTR, SHF_MERGE, ...
+  int entsize;  // SHF_MERGEのセクションの要素サイズ
+  int align;
+  int size;
+  unsigned char* data;
+  Reloc* relocs;  // このセクションに対する再配置
+  int nrelocs;
+  int index;       // セクションヘッダの番号
+  int rela_index;  // .rela<name>のセクションヘッダの番号
+  unsigned char* addr;  // --runで配置したアドレス
+  Section* next;
+};
+
+// ラベルと外部シンボル
+struct Symbol {
+  char* name;
+  Section* sec;  // 定義されたセクション。未定義ならNULL
+  int value;     // セクション内のオフセット
+  bool global;
+  bool used;   // 再配置から参照されている
+  int index;   // シンボルテーブルの番号
+  unsigned char* stub;  // --runで使う、外部関数へ跳ぶ中継コード
+  Symbol* next;      // ハッシュの同じバケットの次のシンボル
+  Symbol* all_next;  // 出現順の次のシンボル
+};
+
+struct Reloc {
+  int offset;
+  int type;  // R_X86_64_PC32, R_X86_64_PLT32, R_X86_64_64, ...
+  Symbol* sym;
+  long addend;
+};
+
+// セクションに並べる命令やデータの単位
+typedef enum {
+  IT_DATA,   // 長さの決まったバイト列
+  IT_ALIGN,  // .p2alignによる詰め物
+  IT_LABEL,  // ラベルの定義
+  IT_JUMP,   // ジャンプ命令。飛び先までの距離で2バイトか5,6バイトになる
+} ItemKind;
+
+struct Item {
+  ItemKind kind;
+  Section* sec;
+  int offset;  // セクション内のオフセット（レイアウト後に決まる）
+  int len;
+  unsigned char* data;  // IT_DATA。NULLならゼロで埋める
+  unsigned char buf[16];  // 命令のような短いデータはここに置く
+  int align;            // IT_ALIGN
+  int cc;               // IT_JUMP: 条件コード。jmpなら-1
+  bool is_long;         // IT_JUMP: rel32の形式で出力する
+  // シンボルを参照するフィールド（IT_DATA, IT_JUMP）。IT_LABELでは定義するラベル
+  Symbol* sym;
+  Symbol* sub;  // sym - sub の形の式で引く側のシンボル
+  long addend;
+  int fix_off;   // フィールドのItem内の位置
+  int fix_size;  // フィールドのバイト数
+  bool pcrel;    // フィールドの位置からの相対値
+  bool plt;      // 関数呼び出し（R_X86_64_PLT32）
+  Item* next;
+};
+
+// 命令のオペランド
+typedef enum { OP_REG, OP_XMM, OP_IMM, OP_MEM, OP_SYM } OpKind;
+
+typedef struct {
+  OpKind kind;
+  int reg;   // レジスタ番号（OP_REG, OP_XMM）
+  int size;  // バイト数。メモリでサイズの指定がなければ0
+  long imm;  // 即値、メモリの変位、シンボルのオフセット
+  int base;  // OP_MEM: ベースレジスタ
+  int index;  // OP_MEM: インデックスレジスタ。なければ-1
+  int scale;
+  bool rip;    // OP_MEM: [rip + sym]
+  Symbol* sym;  // OP_MEM, OP_SYM
+} Operand;
+
+// 1命令分の機械語
+typedef struct {
+  unsigned char buf[16];
+  int len;
+  Symbol* sym;  // rip相対で参照するシンボル
+  long addend;
+  int fix_off;
+} Code;
+
+Section* sections;
+Section* cur_sec;
+Item* items;
+Item* last_item;
+Symbol* all_syms;
+Symbol* last_sym;
+Symbol* sym_hash[4096];
+char* asm_line;  // エラー表示用の処理中の行
+
+// ---- シンボルとセクション ----
+
+Symbol* intern_symbol(char* name, int len) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+  h %= 4096;
+
+  for (Symbol* sym = sym_hash[h]; sym; sym = sym->next)
+    if (strlen(sym->name) == len && !strncmp(sym->name, name, len)) return sym;
+
+  Symbol* sym = calloc(1, sizeof(Symbol));
+  sym->name = strndup(name, len);
+  sym->next = sym_hash[h];
+  sym_hash[h] = sym;
+  if (last_sym)
+    last_sym->all_next = sym;
+  else
+    all_syms = sym;
+  last_sym = sym;
+  return sym;
+}
+
+Section* find_section(char* name, int type, int flags, int entsize) {
+  Section** p = &sections;
+  for (; *p; p = &(*p)->next)
+    if (!strcmp((*p)->name, name)) return *p;
+  Section* sec = calloc(1, sizeof(Section));
+  sec->name = name;
+  sec->type = type;
+  sec->flags = flags;
+  sec->entsize = entsize;
+  sec->align = 1;
+  *p = sec;
+  return sec;
+}
+
+Item* new_item(ItemKind kind) {
+  if (!cur_sec) error("セクションの外に命令があります: %s", asm_line);
+  Item* item = calloc(1, sizeof(Item));
+  item->kind = kind;
+  item->sec = cur_sec;
+  if (last_item)
+    last_item->next = item;
+  else
+    items = item;
+  last_item = item;
+  return item;
+}
+
+// ---- 字句の読み取り ----
+
+bool is_ident_char(char c) {
+  return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+char* skip_space(char* p) {
+  while (*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+// pから始まるlenバイトの単語を、長さsizeのbufにNUL終端してコピーする
+void copy_word(char* buf, int size, char* p, int len) {
+  if (len >= size) len = size - 1;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+}
+
+// pから始まる識別子の長さ
+int ident_len(char* p) {
+  int len = 0;
+  while (is_ident_char(p[len])) len++;
+  return len;
+}
+
+char* reg_names[4][16] = {
+    {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b",
+     "r11b", "r12b", "r13b", "r14b", "r15b"},
+    {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w",
+     "r11w", "r12w", "r13w", "r14w", "r15w"},
+    {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d",
+     "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+    {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10",
+     "r11", "r12", "r13", "r14", "r15"},
+};
+
+// 汎用レジスタならtrueを返し、番号とサイズをセットする
+bool find_reg(char* p, int len, int* reg, int* size) {
+  // r8〜r15とそのサブレジスタ（r8b, r8w, r8d）
+  if (p[0] == 'r' && isdigit(p[1])) {
+    int n = 0;
+    int i = 1;
+    while (i < len && isdigit(p[i])) n = n * 10 + p[i++] - '0';
+    if (n < 8 || n > 15 || len - i > 1) return false;
+    char suffix = i < len ? p[i] : 'q';
+    char* q = strchr("bwdq", suffix);
+    if (!q) return false;
+    *reg = n;
+    *size = 1 << (q - "bwdq");
+    return true;
+  }
+
+  // それ以外は、raxならrとaxのように、接頭辞と2文字の名前に分ける
+  for (int s = 0; s < 4; s++) {
+    for (int i = 0; i < 8; i++) {
+      char* name = reg_names[s][i];
+      if (name[0] == p[0] && strlen(name) == len && !strncmp(name, p, len)) {
+        *reg = i;
+        *size = 1 << s;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// xmm0〜xmm15, ymm0〜ymm15
+bool find_xmm(char* p, int len, int* reg, int* size) {
+  if (len < 4 || (strncmp(p, "xmm", 3) && strncmp(p, "ymm", 3))) return false;
+  for (int i = 3; i < len; i++)
+    if (!isdigit(p[i])) return false;
+  *reg = atoi(p + 3);
+  *size = p[0] == 'x' ? 16 : 32;
+  return *reg < 16;
+}
+
+// 数値かシンボルの項を+と-でつないだ式を読む。
+// シンボルは足す側と引く側に1つずつまで
+char* parse_expr(char* p, Symbol** sym, Symbol** sub, long* val) {
+  *sym = *sub = NULL;
+  *val = 0;
+  int sign = 1;
+  for (;;) {
+    p = skip_space(p);
+    if (*p == '-') {
+      sign = -sign;
+      p = skip_space(p + 1);
+    }
+    if (isdigit(*p)) {
+      char* end;
+      *val += sign * strtol(p, &end, 0);
+      p = end;
+    } else if (is_ident_char(*p)) {
+      int len = ident_len(p);
+      Symbol* s = intern_symbol(p, len);
+      if (sign > 0 && !*sym)
+        *sym = s;
+      else if (sign < 0 && !*sub)
+        *sub = s;
+      else
+        error("扱えない式です: %s", asm_line);
+      p += len;
+    } else {
+      error("式ではありません: %s", asm_line);
+    }
+    p = skip_space(p);
+    if (*p == '+')
+      sign = 1;
+    else if (*p == '-')
+      sign = -1;
+    else
+      return p;
+    p++;
+  }
+}
+
+// [base + index*scale + disp] や [rip + sym] を読む
+void parse_mem(char* p, Operand* op) {
+  op->kind = OP_MEM;
+  op->base = op->index = -1;
+  op->scale = 1;
+  int sign = 1;
+  for (;;) {
+    p = skip_space(p);
+    int len = ident_len(p);
+    int reg, size;
+    if (len == 3 && !strncmp(p, "rip", 3)) {
+      op->rip = true;
+      p += len;
+    } else if (len && !isdigit(*p) && find_reg(p, len, &reg, &size)) {
+      p = skip_space(p + len);
+      if (*p == '*') {
+        op->index = reg;
+        op->scale = strtol(p + 1, &p, 0);
+      } else if (op->base < 0) {
+        op->base = reg;
+      } else {
+        op->index = reg;
+      }
+    } else if (isdigit(*p)) {
+      op->imm += sign * strtol(p, &p, 0);
+    } else if (len && sign > 0 && !op->sym) {
+      op->sym = intern_symbol(p, len);
+      p += len;
+    } else {
+      error("不正なメモリオペランドです: %s", asm_line);
+    }
+    p = skip_space(p);
+    if (*p == ']') break;
+    if (*p != '+' && *p != '-') error("不正なメモリオペランドです: %s", asm_line);
+    sign = *p == '+' ? 1 : -1;
+    p++;
+  }
+  if (op->rip ? op->base >= 0 || op->index >= 0 || !op->sym
+              : op->base < 0 || op->sym || op->index == 4)
+    error("扱えないメモリオペランドです: %s", asm_line);
+}
+
+void parse_operand(char* p, Operand* op) {
+  memset(op, 0, sizeof(Operand));
+  p = skip_space(p);
+
+  char* sizes[] = {"BYTE", "WORD", "DWORD", "QWORD", "XMMWORD", "YMMWORD"};
+  int bytes[] = {1, 2, 4, 8, 16, 32};
+  for (int i = 0; i < 6 && isupper(*p); i++) {
+    int len = strlen(sizes[i]);
+    if (!strncmp(p, sizes[i], len) && p[len] == ' ') {
+      op->size = bytes[i];
+      p = skip_space(p + len);
+      if (strncmp(p, "PTR", 3)) error("PTRがありません: %s", asm_line);
+      p = skip_space(p + 3);
+      break;
+    }
+  }
+
+  if (*p == '[') {
+    int size = op->size;
+    parse_mem(p + 1, op);
+    op->size = size;
+    return;
+  }
+
+  int len = ident_len(p);
+  if (find_reg(p, len, &op->reg, &op->size)) {
+    op->kind = OP_REG;
+    return;
+  }
+  if (find_xmm(p, len, &op->reg, &op->size)) {
+    op->kind = OP_XMM;
+    return;
+  }
+  if (isdigit(*p) || *p == '-') {
+    op->kind = OP_IMM;
+    op->imm = strtol(p, NULL, 0);
+    return;
+  }
+  op->kind = OP_SYM;
+  Symbol* sub;
+  parse_expr(p, &op->sym, &sub, &op->imm);
+  if (sub) error("扱えない式です: %s", asm_line);
+}
+
+// ---- 命令のエンコード ----
+
+bool is_int8(long val) { return -128 <= val && val <= 127; }
+bool is_int32(long val) { return -2147483648L <= val && val <= 2147483647L; }
+
+void put_byte(Code* c, int b) { c->buf[c->len++] = b; }
+
+void put_imm(Code* c, long val, int size) {
+  for (int i = 0; i < size; i++) put_byte(c, val >> (8 * i));
+}
+
+// spl, bpl, sil, dilはREXプレフィックスがないとah, ch, dh, bhになる
+bool needs_rex8(Operand* op) {
+  return op && op->kind == OP_REG && op->size == 1 && 4 <= op->reg &&
+         op->reg < 8;
+}
+
+void put_opcode(Code* c, int opcode) {
+  if (opcode > 0xffff) put_byte(c, opcode >> 16);
+  if (opcode > 0xff) put_byte(c, opcode >> 8);
+  put_byte(c, opcode);
+}
+
+// ModR/M、SIB、変位を出力する。
+// regはModR/Mのregフィールドに入れる値（レジスタ番号か/nの拡張オペコード）
+void put_modrm(Code* c, int reg, Operand* rm) {
+  reg &= 7;
+  if (rm->kind == OP_REG || rm->kind == OP_XMM) {
+    put_byte(c, 0xc0 | reg << 3 | (rm->reg & 7));
+    return;
+  }
+  if (rm->rip) {
+    put_byte(c, 0x05 | reg << 3);
+    c->sym = rm->sym;
+    c->addend = rm->imm;
+    c->fix_off = c->len;
+    put_imm(c, 0, 4);
+    return;
+  }
+
+  int mod = rm->imm == 0 && (rm->base & 7) != 5 ? 0
+            : is_int8(rm->imm)                  ? 1
+                                                : 2;
+  if (rm->index < 0 && (rm->base & 7) != 4) {
+    put_byte(c, mod << 6 | reg << 3 | (rm->base & 7));
+  } else {
+    int ss = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+    int index = rm->index < 0 ? 4 : rm->index & 7;
+    put_byte(c, mod << 6 | reg << 3 | 4);
+    put_byte(c, ss << 6 | index << 3 | (rm->base & 7));
+  }
+  if (mod == 1) put_imm(c, rm->imm, 1);
+  if (mod == 2) put_imm(c, rm->imm, 4);
+}
+
+// rmの拡張ビット（REX.X, REX.B）
+int rm_rex_bits(Operand* rm) {
+  if (rm->kind == OP_REG || rm->kind == OP_XMM) return rm->reg >= 8;
+  if (rm->rip) return 0;
+  return (rm->index >= 8) << 1 | (rm->base >= 8);
+}
+
+// [prefix] [REX] opcode ModR/M ... の形の命令を出力する。
+// rがNULLならModR/Mのregフィールドにはextを入れる
+void encode(Code* c, int prefix, bool w, int opcode, Operand* r, int ext,
+            Operand* rm) {
+  int reg = r ? r->reg : ext;
+  if (prefix) put_byte(c, prefix);
+  int rex = w << 3 | (reg >= 8) << 2 | rm_rex_bits(rm);
+  if (rex || needs_rex8(r) || needs_rex8(rm)) put_byte(c, 0x40 | rex);
+  put_opcode(c, opcode);
+  put_modrm(c, reg, rm);
+}
+
+// VEXプレフィックス付きの命令を出力する。
+// pp: 0=なし 1=66 2=F3 3=F2, map: 1=0F 2=0F38 3=0F3A, vvvv: 2つ目のソース
+void encode_vex(Code* c, int pp, int map, bool w, bool l, int opcode,
+                Operand* r, int vvvv, Operand* rm) {
+  int bits = rm_rex_bits(rm);
+  int rx = !(r->reg >= 8) << 7 | !(bits & 2) << 6 | !(bits & 1) << 5;
+  int tail = (~vvvv & 15) << 3 | l << 2 | pp;
+  if (map == 1 && !w && !(bits & 3)) {
+    put_byte(c, 0xc5);
+    put_byte(c, (rx & 0x80) | tail);
+  } else {
+    put_byte(c, 0xc4);
+    put_byte(c, rx | map);
+    put_byte(c, w << 7 | tail);
+  }
+  put_byte(c, opcode);
+  put_modrm(c, r->reg, rm);
+}
+
+int find_name(char* name, char** names, int n) {
+  for (int i = 0; i < n; i++)
+    if (!strcmp(name, names[i])) return i;
+  return -1;
+}
+
+char* cc_names[] = {"o",  "no", "b",  "ae", "e",   "ne", "be", "a",
+                    "s",  "ns", "p",  "np", "l",   "ge", "le", "g",
+                    "c",  "nc", "z",  "nz", "nae", "nb", "na", "nbe",
+                    "pe", "po", "nge", "nl", "ng", "nle"};
+int cc_codes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                  2, 3, 4, 5, 2, 3, 6, 7, 10, 11, 12, 13, 14, 15};
+
+// 条件コード（"e", "ne", "l"など）の番号。なければ-1
+int find_cc(char* name) {
+  int i = find_name(name, cc_names, 30);
+  return i < 0 ? -1 : cc_codes[i];
+}
+
+// オペランドのない命令
+typedef struct {
+  char* name;
+  char* bytes;
+  int len;
+} FixedInst;
+
+FixedInst fixed_insts[] = {
+    {"ret", "\xc3", 1},           {"leave", "\xc9", 1},
+    {"cqo", "\x48\x99", 2},       {"cdq", "\x99", 1},
+    {"cdqe", "\x48\x98", 2},      {"nop", "\x90", 1},
+    {"rdtsc", "\x0f\x31", 2},     {"rdtscp", "\x0f\x01\xf9", 3},
+    {"lfence", "\x0f\xae\xe8", 3}, {"mfence", "\x0f\xae\xf0", 3},
+    {"cpuid", "\x0f\xa2", 2},     {"ud2", "\x0f\x0b", 2},
+    {"vzeroupper", "\xc5\xf8\x77", 3},
+    {"rep movsb", "\xf3\xa4", 2}, {"rep stosb", "\xf3\xaa", 2},
+    {"rep movsq", "\xf3\x48\xa5", 3}, {"rep stosq", "\xf3\x48\xab", 3},
+};
+
+// 2つのxmmレジスタ（AVXでは3つ）を取るSIMDの演算
+typedef struct {
+  char* name;
+  int opcode;  // 0x66プレフィックスの後に続くオペコード
+} SimdOp;
+
+SimdOp simd_ops[] = {
+    {"paddb", 0x0ffc},   {"paddw", 0x0ffd},   {"paddd", 0x0ffe},
+    {"paddq", 0x0fd4},   {"psubb", 0x0ff8},   {"psubw", 0x0ff9},
+    {"psubd", 0x0ffa},   {"psubq", 0x0ffb},   {"pmullw", 0x0fd5},
+    {"pmulld", 0x0f3840}, {"pand", 0x0fdb},   {"por", 0x0feb},
+    {"pxor", 0x0fef},    {"pcmpeqb", 0x0f74}, {"pcmpeqd", 0x0f76},
+};
+
+// xmmレジスタとメモリの間の転送
+typedef struct {
+  char* name;
+  int prefix;
+  int load;   // xmm <- xmm/m
+  int store;  // m <- xmm
+} SimdMove;
+
+SimdMove simd_moves[] = {
+    {"movdqu", 0xf3, 0x0f6f, 0x0f7f},
+    {"movdqa", 0x66, 0x0f6f, 0x0f7f},
+    {"movups", 0, 0x0f10, 0x0f11},
+    {"movaps", 0, 0x0f28, 0x0f29},
+};
+
+char* alu_names[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+char* unary_names[] = {"", "", "not", "neg", "mul", "imul", "div", "idiv"};
+char* shift_names[] = {"rol", "ror", "", "", "shl", "shr", "sal", "sar"};
+
+// レジスタオペランドがあればそのサイズ、なければメモリに指定されたサイズ
+int operand_size(Operand* ops, int nops) {
+  for (int i = 0; i < nops; i++)
+    if (ops[i].kind == OP_REG) return ops[i].size;
+  for (int i = 0; i < nops; i++)
+    if (ops[i].kind == OP_MEM && ops[i].size) return ops[i].size;
+  error("オペランドのサイズが分かりません: %s", asm_line);
+}
+
+bool is_rm(Operand* op) { return op->kind == OP_REG || op->kind == OP_MEM; }
+
+void encode_simd(Code* c, char* mn, Operand* ops, int nops) {
+  bool vex = mn[0] == 'v';
+  char* name = vex ? mn + 1 : mn;
+  Operand* d = &ops[0];
+  Operand* s = &ops[1];
+  bool l = d->size == 32 || s->size == 32;
+
+  for (int i = 0; i < sizeof(simd_ops) / sizeof(*simd_ops); i++) {
+    if (strcmp(name, simd_ops[i].name)) continue;
+    int op = simd_ops[i].opcode;
+    int map = op > 0xffff ? 2 : 1;
+    if (vex && nops == 3 && d->kind == OP_XMM && s->kind == OP_XMM) {
+      encode_vex(c, 1, map, false, l, op, d, s->reg, &ops[2]);
+      return;
+    }
+    if (!vex && nops == 2 && d->kind == OP_XMM) {
+      encode(c, 0x66, false, op, d, 0, s);
+      return;
+    }
+  }
+
+  for (int i = 0; i < sizeof(simd_moves) / sizeof(*simd_moves); i++) {
+    SimdMove* m = &simd_moves[i];
+    if (strcmp(name, m->name) || nops != 2) continue;
+    int pp = m->prefix == 0x66 ? 1 : m->prefix == 0xf3 ? 2 : 0;
+    if (d->kind == OP_XMM) {
+      if (vex) {
+        encode_vex(c, pp, 1, false, l, m->load, d, 0, s);
+        return;
+      }
+      encode(c, m->prefix, false, m->load, d, 0, s);
+      return;
+    }
+    if (s->kind == OP_XMM && d->kind == OP_MEM) {
+      if (vex) {
+        encode_vex(c, pp, 1, false, l, m->store, s, 0, d);
+        return;
+      }
+      encode(c, m->prefix, false, m->store, s, 0, d);
+      return;
+    }
+  }
+
+  // movd/movq: 汎用レジスタとの間の転送
+  if ((!strcmp(name, "movd") || !strcmp(name, "movq")) && nops == 2) {
+    bool w = name[3] == 'q';
+    if (d->kind == OP_XMM && is_rm(s)) {
+      if (vex) {
+        encode_vex(c, 1, 1, w, false, 0x6e, d, 0, s);
+        return;
+      }
+      encode(c, 0x66, w, 0x0f6e, d, 0, s);
+      return;
+    }
+    if (s->kind == OP_XMM && is_rm(d)) {
+      if (vex) {
+        encode_vex(c, 1, 1, w, false, 0x7e, s, 0, d);
+        return;
+      }
+      encode(c, 0x66, w, 0x0f7e, s, 0, d);
+      return;
+    }
+  }
+
+  if (!strcmp(name, "pshufd") && nops == 3 && d->kind == OP_XMM) {
+    if (vex)
+      encode_vex(c, 1, 1, false, l, 0x70, d, 0, s);
+    else
+      encode(c, 0x66, false, 0x0f70, d, 0, s);
+    put_imm(c, ops[2].imm, 1);
+    return;
+  }
+
+  // vpbroadcastb/w/d/q
+  if (vex && !strncmp(name, "pbroadcast", 10) && nops == 2) {
+    int i = find_name(name + 10, (char*[]){"b", "w", "d", "q"}, 4);
+    int opcode[] = {0x78, 0x79, 0x58, 0x59};
+    if (i >= 0 && d->kind == OP_XMM) {
+      encode_vex(c, 1, 2, false, l, opcode[i], d, 0, s);
+      return;
+    }
+  }
+
+  error("アセンブルできない命令です: %s", asm_line);
+}
+
+// ジャンプ、コール以外の命令をエンコードする
+void encode_inst(Code* c, char* mn, Operand* ops, int nops) {
+  Operand* d = &ops[0];
+  Operand* s = &ops[1];
+
+  for (int i = 0; nops == 0 && i < sizeof(fixed_insts) / sizeof(*fixed_insts);
+       i++) {
+    if (!strcmp(mn, fixed_insts[i].name)) {
+      memcpy(c->buf, fixed_insts[i].bytes, fixed_insts[i].len);
+      c->len = fixed_insts[i].len;
+      return;
+    }
+  }
+
+  for (int i = 0; i < nops; i++) {
+    if (ops[i].kind == OP_XMM) {
+      encode_simd(c, mn, ops, nops);
+      return;
+    }
+  }
+
+  int alu = find_name(mn, alu_names, 8);
+  if (alu >= 0 && nops == 2) {
+    int size = operand_size(ops, nops);
+    int p66 = size == 2 ? 0x66 : 0;
+    if (s->kind == OP_IMM) {
+      if (size == 1) {
+        if (d->kind == OP_REG && d->reg == 0)
+          put_byte(c, alu * 8 + 4);
+        else
+          encode(c, 0, false, 0x80, NULL, alu, d);
+        put_imm(c, s->imm, 1);
+        return;
+      }
+      if (is_int8(s->imm)) {
+        encode(c, p66, size == 8, 0x83, NULL, alu, d);
+        put_imm(c, s->imm, 1);
+        return;
+      }
+      if (d->kind == OP_REG && d->reg == 0) {
+        // al, ax, eax, raxに対しては短い形式がある
+        if (p66) put_byte(c, p66);
+        if (size == 8) put_byte(c, 0x48);
+        put_byte(c, alu * 8 + 5);
+      } else {
+        encode(c, p66, size == 8, 0x81, NULL, alu, d);
+      }
+      put_imm(c, s->imm, size == 2 ? 2 : 4);
+      return;
+    }
+    if (s->kind == OP_REG) {
+      encode(c, p66, size == 8, alu * 8 + (size == 1 ? 0 : 1), s, 0, d);
+      return;
+    }
+    if (d->kind == OP_REG && s->kind == OP_MEM) {
+      encode(c, p66, size == 8, alu * 8 + (size == 1 ? 2 : 3), d, 0, s);
+      return;
+    }
+  }
+
+  if (!strcmp(mn, "mov") && nops == 2) {
+    int size = operand_size(ops, nops);
+    int p66 = size == 2 ? 0x66 : 0;
+    if (s->kind == OP_IMM && d->kind == OP_REG) {
+      if (size == 8 && is_int32(s->imm)) {
+        encode(c, 0, true, 0xc7, NULL, 0, d);
+        put_imm(c, s->imm, 4);
+        return;
+      }
+      // mov r, imm: オペコードにレジスタ番号を足す短い形式
+      if (p66) put_byte(c, p66);
+      int rex = (size == 8) << 3 | (d->reg >= 8);
+      if (rex || needs_rex8(d)) put_byte(c, 0x40 | rex);
+      put_byte(c, (size == 1 ? 0xb0 : 0xb8) + (d->reg & 7));
+      put_imm(c, s->imm, size);
+      return;
+    }
+    if (s->kind == OP_IMM && d->kind == OP_MEM) {
+      encode(c, p66, size == 8, size == 1 ? 0xc6 : 0xc7, NULL, 0, d);
+      put_imm(c, s->imm, size == 8 ? 4 : size);
+      return;
+    }
+    if (s->kind == OP_REG && is_rm(d)) {
+      encode(c, p66, size == 8, size == 1 ? 0x88 : 0x89, s, 0, d);
+      return;
+    }
+    if (d->kind == OP_REG && s->kind == OP_MEM) {
+      encode(c, p66, size == 8, size == 1 ? 0x8a : 0x8b, d, 0, s);
+      return;
+    }
+  }
+
+  if ((!strcmp(mn, "movzx") || !strcmp(mn, "movsx")) && nops == 2 &&
+      d->kind == OP_REG) {
+    int ssize = s->size ? s->size : 1;
+    int opcode = (mn[3] == 'z' ? 0x0fb6 : 0x0fbe) + (ssize == 2);
+    encode(c, d->size == 2 ? 0x66 : 0, d->size == 8, opcode, d, 0, s);
+    return;
+  }
+
+  if (!strcmp(mn, "movsxd") && nops == 2 && d->kind == OP_REG) {
+    encode(c, 0, true, 0x63, d, 0, s);
+    return;
+  }
+
+  if (!strcmp(mn, "lea") && nops == 2 && d->kind == OP_REG &&
+      s->kind == OP_MEM) {
+    encode(c, d->size == 2 ? 0x66 : 0, d->size == 8, 0x8d, d, 0, s);
+    return;
+  }
+
+  if (!strcmp(mn, "push") && nops == 1) {
+    if (d->kind == OP_REG) {
+      if (d->reg >= 8) put_byte(c, 0x41);
+      put_byte(c, 0x50 + (d->reg & 7));
+      return;
+    }
+    if (d->kind == OP_IMM) {
+      put_byte(c, is_int8(d->imm) ? 0x6a : 0x68);
+      put_imm(c, d->imm, is_int8(d->imm) ? 1 : 4);
+      return;
+    }
+    if (d->kind == OP_MEM) {
+      encode(c, 0, false, 0xff, NULL, 6, d);
+      return;
+    }
+  }
+
+  if (!strcmp(mn, "pop") && nops == 1) {
+    if (d->kind == OP_REG) {
+      if (d->reg >= 8) put_byte(c, 0x41);
+      put_byte(c, 0x58 + (d->reg & 7));
+      return;
+    }
+    if (d->kind == OP_MEM) {
+      encode(c, 0, false, 0x8f, NULL, 0, d);
+      return;
+    }
+  }
+
+  if (!strcmp(mn, "test") && nops == 2) {
+    int size = operand_size(ops, nops);
+    int p66 = size == 2 ? 0x66 : 0;
+    if (s->kind == OP_IMM) {
+      encode(c, p66, size == 8, size == 1 ? 0xf6 : 0xf7, NULL, 0, d);
+      put_imm(c, s->imm, size == 8 ? 4 : size);
+      return;
+    }
+    if (s->kind == OP_REG) {
+      encode(c, p66, size == 8, size == 1 ? 0x84 : 0x85, s, 0, d);
+      return;
+    }
+  }
+
+  if (!strcmp(mn, "imul") && nops >= 2 && d->kind == OP_REG) {
+    bool w = d->size == 8;
+    int p66 = d->size == 2 ? 0x66 : 0;
+    if (nops == 2 && s->kind != OP_IMM) {
+      encode(c, p66, w, 0x0faf, d, 0, s);
+      return;
+    }
+    // imul r, imm は imul r, r, imm と同じ
+    Operand* src = nops == 2 ? d : s;
+    long imm = ops[nops - 1].imm;
+    encode(c, p66, w, is_int8(imm) ? 0x6b : 0x69, d, 0, src);
+    put_imm(c, imm, is_int8(imm) ? 1 : d->size == 2 ? 2 : 4);
+    return;
+  }
+
+  int unary = find_name(mn, unary_names, 8);
+  if (unary >= 2 && nops == 1) {
+    int size = operand_size(ops, nops);
+    encode(c, size == 2 ? 0x66 : 0, size == 8, size == 1 ? 0xf6 : 0xf7,
+           NULL, unary, d);
+    return;
+  }
+
+  if ((!strcmp(mn, "inc") || !strcmp(mn, "dec")) && nops == 1) {
+    int size = operand_size(ops, nops);
+    encode(c, size == 2 ? 0x66 : 0, size == 8, size == 1 ? 0xfe : 0xff,
+           NULL, mn[0] == 'd', d);
+    return;
+  }
+
+  int shift = find_name(mn, shift_names, 8);
+  if (shift >= 0 && nops == 2) {
+    if (shift == 6) shift = 4;  // salはshlと同じ
+    int size = operand_size(ops, 1);
+    int p66 = size == 2 ? 0x66 : 0;
+    bool b = size == 1;
+    if (s->kind == OP_IMM && s->imm == 1) {
+      encode(c, p66, size == 8, b ? 0xd0 : 0xd1, NULL, shift, d);
+      return;
+    }
+    if (s->kind == OP_IMM) {
+      encode(c, p66, size == 8, b ? 0xc0 : 0xc1, NULL, shift, d);
+      put_imm(c, s->imm, 1);
+      return;
+    }
+    if (s->kind == OP_REG && s->reg == 1 && s->size == 1) {
+      encode(c, p66, size == 8, b ? 0xd2 : 0xd3, NULL, shift, d);
+      return;
+    }
+  }
+
+  if (!strncmp(mn, "set", 3) && find_cc(mn + 3) >= 0 && nops == 1) {
+    encode(c, 0, false, 0x0f90 + find_cc(mn + 3), NULL, 0, d);
+    return;
+  }
+
+  if (!strncmp(mn, "cmov", 4) && find_cc(mn + 4) >= 0 && nops == 2 &&
+      d->kind == OP_REG) {
+    encode(c, d->size == 2 ? 0x66 : 0, d->size == 8,
+           0x0f40 + find_cc(mn + 4), d, 0, s);
+    return;
+  }
+
+  // レジスタやメモリを経由した間接ジャンプ、間接コール
+  if ((!strcmp(mn, "jmp") || !strcmp(mn, "call")) && nops == 1 && is_rm(d)) {
+    encode(c, 0, false, 0xff, NULL, mn[0] == 'j' ? 4 : 2, d);
+    return;
+  }
+
+  error("アセンブルできない命令です: %s", asm_line);
+}
+
+// ---- ディレクティブ ----
+
+// .section name[,"flags"[,@type[,entsize]]]
+void parse_section(char* p) {
+  p = skip_space(p);
+  int len = 0;
+  while (p[len] && p[len] != ',' && p[len] != ' ') len++;
+  char* name = strndup(p, len);
+  p = skip_space(p + len);
+
+  int flags = SHF_ALLOC;
+  if (!strncmp(name, ".text", 5)) flags |= SHF_EXECINSTR;
+  if (!strncmp(name, ".data", 5) || !strncmp(name, ".bss", 4))
+    flags |= SHF_WRITE;
+  if (!strncmp(name, ".note", 5)) flags = 0;
+  int type = strncmp(name, ".bss", 4) ? SHT_PROGBITS : SHT_NOBITS;
+  int entsize = 0;
+
+  if (*p == ',') {
+    p = skip_space(p + 1);
+    if (*p != '"') error("セクションの属性がありません: %s", asm_line);
+    flags = 0;
+    for (p++; *p != '"'; p++) {
+      if (*p == 'a') flags |= SHF_ALLOC;
+      if (*p == 'w') flags |= SHF_WRITE;
+      if (*p == 'x') flags |= SHF_EXECINSTR;
+      if (*p == 'M') flags |= SHF_MERGE;
+      if (*p == 'S') flags |= SHF_STRINGS;
+    }
+    p = skip_space(p + 1);
+  }
+  if (*p == ',') {
+    p = skip_space(p + 1);
+    if (!strncmp(p, "@nobits", 7)) type = SHT_NOBITS;
+    p = skip_space(p + ident_len(p + 1) + 1);
+  }
+  if (*p == ',') entsize = atoi(p + 1);
+
+  cur_sec = find_section(name, type, flags, entsize);
+}
+
+// .string "..." のエスケープシーケンスを解釈してバイト列にする
+Item* parse_string(char* p, bool nul) {
+  p = skip_space(p);
+  if (*p != '"') error("文字列がありません: %s", asm_line);
+  Item* item = new_item(IT_DATA);
+  item->data = calloc(1, strlen(p) + 1);
+  for (p++; *p != '"'; p++) {
+    if (!*p) error("文字列が閉じられていません: %s", asm_line);
+    if (*p != '\\') {
+      item->data[item->len++] = *p;
+      continue;
+    }
+    p++;
+    int c;
+    if ('0' <= *p && *p <= '7') {
+      c = 0;
+      for (int i = 0; i < 3 && '0' <= *p && *p <= '7'; i++) c = c * 8 + *p++ - '0';
+      p--;
+    } else if (*p == 'x') {
+      c = strtol(p + 1, &p, 16);
+      p--;
+    } else {
+      char* from = "abfnrtv";
+      char* to = "\a\b\f\n\r\t\v";
+      char* q = strchr(from, *p);
+      c = q ? to[q - from] : *p;
+    }
+    item->data[item->len++] = c;
+  }
+  if (nul) item->data[item->len++] = '\0';
+  return item;
+}
+
+// .byte, .short, .long, .quad: カンマで区切った式を並べる
+void parse_data(char* p, int size) {
+  for (;;) {
+    Item* item = new_item(IT_DATA);
+    item->len = size;
+    item->data = item->buf;
+    Symbol* sym;
+    Symbol* sub;
+    p = parse_expr(p, &sym, &sub, &item->addend);
+    if (sym || sub) {
+      item->sym = sym;
+      item->sub = sub;
+      item->fix_size = size;
+    } else {
+      memcpy(item->data, &item->addend, size);
+    }
+    p = skip_space(p);
+    if (*p != ',') return;
+    p++;
+  }
+}
+
+void parse_directive(char* p) {
+  int len = ident_len(p);
+  char name[32];
+  copy_word(name, sizeof(name), p, len);
+  p = skip_space(p + len);
+
+  // デバッグ情報などの、オブジェクトファイルの中身に影響しないもの
+  char* ignored[] = {".intel_syntax", ".file", ".loc", ".type", ".size",
+                     ".ident", ".cfi_startproc", ".cfi_endproc"};
+  int nignored = sizeof(ignored) / sizeof(*ignored);
+
+  if (!strcmp(name, ".text") || !strcmp(name, ".data") ||
+      !strcmp(name, ".bss")) {
+    parse_section(name);
+  } else if (!strcmp(name, ".section")) {
+    parse_section(p);
+  } else if (!strcmp(name, ".globl") || !strcmp(name, ".global")) {
+    intern_symbol(p, ident_len(p))->global = true;
+  } else if (!strcmp(name, ".p2align") || !strcmp(name, ".balign") ||
+             !strcmp(name, ".align")) {
+    int align = atoi(p);
+    if (name[1] == 'p') align = 1 << align;
+    Item* item = new_item(IT_ALIGN);
+    item->align = align;
+    if (cur_sec->align < align) cur_sec->align = align;
+  } else if (!strcmp(name, ".zero")) {
+    new_item(IT_DATA)->len = atoi(p);
+  } else if (!strcmp(name, ".string") || !strcmp(name, ".asciz")) {
+    parse_string(p, true);
+  } else if (!strcmp(name, ".ascii")) {
+    parse_string(p, false);
+  } else if (!strcmp(name, ".byte")) {
+    parse_data(p, 1);
+  } else if (!strcmp(name, ".short") || !strcmp(name, ".value")) {
+    parse_data(p, 2);
+  } else if (!strcmp(name, ".long")) {
+    parse_data(p, 4);
+  } else if (!strcmp(name, ".quad")) {
+    parse_data(p, 8);
+  } else if (find_name(name, ignored, nignored) < 0) {
+    error("扱えないディレクティブです: %s", asm_line);
+  }
+}
+
+// ---- 命令の行 ----
+
+void parse_inst(char* p) {
+  // ニーモニック。repは続く命令と合わせて1つのニーモニックとして扱う
+  int len = ident_len(p);
+  char mn[32];
+  copy_word(mn, sizeof(mn), p, len);
+  p = skip_space(p + len);
+  if (!strcmp(mn, "rep")) {
+    len = ident_len(p);
+    copy_word(mn + 4, sizeof(mn) - 4, p, len);
+    mn[3] = ' ';
+    p = skip_space(p + len);
+  }
+
+  Operand ops[4];
+  int nops = 0;
+  while (*p) {
+    if (nops == 4) error("オペランドが多すぎます: %s", asm_line);
+    parse_operand(p, &ops[nops++]);
+    p = strchr(p, ',');
+    if (!p) break;
+    p++;
+  }
+
+  // ラベルへのジャンプ
+  int cc = mn[0] == 'j' ? find_cc(mn + 1) : -1;
+  if ((cc >= 0 || !strcmp(mn, "jmp")) && nops == 1 && ops[0].kind == OP_SYM) {
+    Item* item = new_item(IT_JUMP);
+    item->cc = cc;
+    item->sym = ops[0].sym;
+    item->addend = ops[0].imm;
+    return;
+  }
+
+  // 関数呼び出し: call rel32
+  if (!strcmp(mn, "call") && nops == 1 && ops[0].kind == OP_SYM) {
+    Item* item = new_item(IT_DATA);
+    item->len = 5;
+    item->data = item->buf;
+    item->data[0] = 0xe8;
+    item->sym = ops[0].sym;
+    item->addend = ops[0].imm - 4;
+    item->fix_off = 1;
+    item->fix_size = 4;
+    item->pcrel = true;
+    item->plt = true;
+    return;
+  }
+
+  Code c = {0};
+  encode_inst(&c, mn, ops, nops);
+  Item* item = new_item(IT_DATA);
+  item->len = c.len;
+  item->data = item->buf;
+  memcpy(item->data, c.buf, c.len);
+  if (c.sym) {
+    // rip相対のアドレスは命令の末尾からの距離
+    item->sym = c.sym;
+    item->addend = c.addend - (c.len - c.fix_off);
+    item->fix_off = c.fix_off;
+    item->fix_size = 4;
+    item->pcrel = true;
+  }
+}
+
+void parse_line(char* line) {
+  asm_line = line;
+  char* p = skip_space(line);
+  if (!*p || *p == '#') return;
+
+  int len = ident_len(p);
+  if (len && p[len] == ':') {
+    Symbol* sym = intern_symbol(p, len);
+    if (sym->sec) error("ラベルが重複しています: %s", line);
+    Item* item = new_item(IT_LABEL);
+    item->sym = sym;
+    sym->sec = cur_sec;
+    parse_line(p + len + 1);
+    return;
+  }
+
+  if (*p == '.')
+    parse_directive(p);
+  else
+    parse_inst(p);
+}
+
+// ---- レイアウトと出力 ----
+
+// 各Itemのオフセットを決める。rel8に収まらないジャンプを
+// rel32に伸ばしながら、変化がなくなるまで繰り返す
+void layout() {
+  for (;;) {
+    for (Section* sec = sections; sec; sec = sec->next) sec->size = 0;
+    for (Item* item = items; item; item = item->next) {
+      int off = item->sec->size;
+      if (item->kind == IT_ALIGN) item->len = align_to(off, item->align) - off;
+      if (item->kind == IT_LABEL) item->sym->value = off;
+      if (item->kind == IT_JUMP)
+        item->len = !item->is_long ? 2 : item->cc < 0 ? 5 : 6;
+      item->offset = off;
+      item->sec->size += item->len;
+    }
+
+    bool changed = false;
+    for (Item* item = items; item; item = item->next) {
+      if (item->kind != IT_JUMP || item->is_long) continue;
+      long disp = item->sym->value + item->addend - (item->offset + 2);
+      if (item->sym->sec != item->sec || !is_int8(disp)) {
+        item->is_long = true;
+        changed = true;
+      }
+    }
+    if (!changed) return;
+  }
+}
+
+void add_reloc(Section* sec, int offset, int type, Symbol* sym, long addend) {
+  sec->relocs = realloc(sec->relocs, sizeof(Reloc) * (sec->nrelocs + 1));
+  sec->relocs[sec->nrelocs++] = (Reloc){offset, type, sym, addend};
+  sym->used = true;
+}
+
+// Itemの中のシンボルを参照するフィールドを埋めるか、再配置を作る
+void apply_fixup(Item* item) {
+  Section* sec = item->sec;
+  int pos = item->offset + item->fix_off;
+  unsigned char* field = sec->data + pos;
+  long val = item->addend;
+  Symbol* sym = item->sym;
+  bool pcrel = item->pcrel;
+
+  if (item->sub) {
+    Symbol* sub = item->sub;
+    if (sym && sym->sec && sym->sec == sub->sec) {
+      // 同じセクションのラベルの差は定数
+      val += sym->value - sub->value;
+      sym = NULL;
+    } else if (sub->sec == sec && !pcrel) {
+      // sym - sub = sym + (pos - sub) - pos
+      val += pos - sub->value;
+      pcrel = true;
+    } else {
+      error("計算できない式です: %s - %s", sym ? sym->name : "",
+            sub->name);
+    }
+  }
+
+  if (!sym) {
+    memcpy(field, &val, item->fix_size);
+    return;
+  }
+  if (pcrel && sym->sec == sec) {
+    val += sym->value - pos;
+    memcpy(field, &val, item->fix_size);
+    return;
+  }
+  int type = pcrel ? (item->plt ? R_X86_64_PLT32 : R_X86_64_PC32)
+             : item->fix_size == 8 ? R_X86_64_64
+                                   : R_X86_64_32;
+  add_reloc(sec, pos, type, sym, val);
+}
+
+// 実行されるセクションの詰め物に使う、長さ1〜8バイトのnop
+char* nops[] = {
+    "\x90",
+    "\x66\x90",
+    "\x0f\x1f\x00",
+    "\x0f\x1f\x40\x00",
+    "\x0f\x1f\x44\x00\x00",
+    "\x66\x0f\x1f\x44\x00\x00",
+    "\x0f\x1f\x80\x00\x00\x00\x00",
+    "\x0f\x1f\x84\x00\x00\x00\x00\x00",
+};
+
+void write_sections() {
+  for (Section* sec = sections; sec; sec = sec->next)
+    if (sec->type != SHT_NOBITS) sec->data = calloc(1, sec->size + 1);
+
+  for (Item* item = items; item; item = item->next) {
+    Section* sec = item->sec;
+    if (item->kind == IT_LABEL) continue;
+    if (sec->type == SHT_NOBITS) {
+      if (item->data || item->sym) error("%sにデータは置けません", sec->name);
+      continue;
+    }
+    unsigned char* p = sec->data + item->offset;
+
+    if (item->kind == IT_ALIGN && (sec->flags & SHF_EXECINSTR)) {
+      for (int n = item->len; n > 0;) {
+        int k = n > 8 ? 8 : n;
+        memcpy(p, nops[k - 1], k);
+        p += k;
+        n -= k;
+      }
+      continue;
+    }
+
+    if (item->kind == IT_JUMP) {
+      if (!item->is_long) {
+        p[0] = item->cc < 0 ? 0xeb : 0x70 + item->cc;
+        p[1] = item->sym->value + item->addend - (item->offset + 2);
+        continue;
+      }
+      if (item->cc < 0) {
+        p[0] = 0xe9;
+        item->fix_off = 1;
+      } else {
+        p[0] = 0x0f;
+        p[1] = 0x80 + item->cc;
+        item->fix_off = 2;
+      }
+      item->addend -= 4;
+      item->fix_size = 4;
+      item->pcrel = true;
+      item->plt = !item->sym->sec;
+      apply_fixup(item);
+      continue;
+    }
+
+    if (item->data) memcpy(p, item->data, item->len);
+    if (item->sym || item->sub) apply_fixup(item);
+  }
+}
+
+// バイト列のバッファ
+typedef struct {
+  char* data;
+  int len;
+} Buf;
+
+int buf_add(Buf* buf, void* p, int len) {
+  int off = buf->len;
+  buf->data = realloc(buf->data, buf->len + len);
+  memcpy(buf->data + buf->len, p, len);
+  buf->len += len;
+  return off;
+}
+
+int buf_add_str(Buf* buf, char* s) { return buf_add(buf, s, strlen(s) + 1); }
+
+void buf_align(Buf* buf, int align) {
+  static char zero[16];
+  buf_add(buf, zero, align_to(buf->len, align) - buf->len);
+}
+
+void write_elf(char* path) {
+  // セクションの番号: 0は空、その後に出力するセクション、
+  // .rela.*、.symtab、.strtab、.shstrtab の順に並べる
+  int nsec = 1;
+  for (Section* sec = sections; sec; sec = sec->next) sec->index = nsec++;
+  for (Section* sec = sections; sec; sec = sec->next)
+    if (sec->nrelocs) sec->rela_index = nsec++;
+  int symtab_index = nsec++;
+  int strtab_index = nsec++;
+  int shstrtab_index = nsec++;
+
+  // シンボルテーブル: ローカルシンボルを先に、グローバルシンボルを後に置く。
+  // .Lで始まるラベルは再配置から参照されているものだけ含める
+  Buf strtab = {0};
+  Buf symtab = {0};
+  buf_add_str(&strtab, "");
+  buf_add(&symtab, &(Elf64_Sym){0}, sizeof(Elf64_Sym));
+  int nsyms = 1;
+  int first_global = 0;
+  for (int global = 0; global < 2; global++) {
+    if (global) first_global = nsyms;
+    for (Symbol* sym = all_syms; sym; sym = sym->all_next) {
+      bool is_global = sym->global || !sym->sec;
+      if (is_global != global) continue;
+      if (!sym->used && !sym->global &&
+          (!sym->sec || !strncmp(sym->name, ".L", 2)))
+        continue;
+      Elf64_Sym esym = {0};
+      esym.st_name = buf_add_str(&strtab, sym->name);
+      int type = !sym->sec                            ? STT_NOTYPE
+                 : sym->sec->flags & SHF_EXECINSTR ? STT_FUNC
+                                                   : STT_OBJECT;
+      if (!strncmp(sym->name, ".L", 2)) type = STT_NOTYPE;
+      esym.st_info = ELF64_ST_INFO(is_global ? STB_GLOBAL : STB_LOCAL, type);
+      esym.st_shndx = sym->sec ? sym->sec->index : SHN_UNDEF;
+      esym.st_value = sym->value;
+      buf_add(&symtab, &esym, sizeof(esym));
+      sym->index = nsyms++;
+    }
+  }
+
+  Buf shstrtab = {0};
+  buf_add_str(&shstrtab, "");
+  Elf64_Shdr* shdrs = calloc(nsec, sizeof(Elf64_Shdr));
+
+  // ELFヘッダの場所を空けておき、最後に埋める
+  Buf out = {0};
+  buf_add(&out, &(Elf64_Ehdr){0}, sizeof(Elf64_Ehdr));
+
+  for (Section* sec = sections; sec; sec = sec->next) {
+    Elf64_Shdr* sh = &shdrs[sec->index];
+    sh->sh_name = buf_add_str(&shstrtab, sec->name);
+    sh->sh_type = sec->type;
+    sh->sh_flags = sec->flags;
+    sh->sh_addralign = sec->align;
+    sh->sh_entsize = sec->entsize;
+    sh->sh_size = sec->size;
+    buf_align(&out, sec->align < 16 ? sec->align : 16);
+    sh->sh_offset = out.len;
+    if (sec->type != SHT_NOBITS) buf_add(&out, sec->data, sec->size);
+  }
+
+  for (Section* sec = sections; sec; sec = sec->next) {
+    if (!sec->nrelocs) continue;
+    char name[256];
+    snprintf(name, sizeof(name), ".rela%s", sec->name);
+    Elf64_Shdr* sh = &shdrs[sec->rela_index];
+    sh->sh_name = buf_add_str(&shstrtab, name);
+    sh->sh_type = SHT_RELA;
+    sh->sh_flags = SHF_INFO_LINK;
+    sh->sh_link = symtab_index;
+    sh->sh_info = sec->index;
+    sh->sh_addralign = 8;
+    sh->sh_entsize = sizeof(Elf64_Rela);
+    buf_align(&out, 8);
+    sh->sh_offset = out.len;
+    for (int i = 0; i < sec->nrelocs; i++) {
+      Reloc* r = &sec->relocs[i];
+      Elf64_Rela rela = {r->offset, ELF64_R_INFO(r->sym->index, r->type),
+                         r->addend};
+      buf_add(&out, &rela, sizeof(rela));
+    }
+    sh->sh_size = sec->nrelocs * sizeof(Elf64_Rela);
+  }
+
+  Elf64_Shdr* sh = &shdrs[symtab_index];
+  sh->sh_name = buf_add_str(&shstrtab, ".symtab");
+  sh->sh_type = SHT_SYMTAB;
+  sh->sh_link = strtab_index;
+  sh->sh_info = first_global;
+  sh->sh_addralign = 8;
+  sh->sh_entsize = sizeof(Elf64_Sym);
+  buf_align(&out, 8);
+  sh->sh_offset = buf_add(&out, symtab.data, symtab.len);
+  sh->sh_size = symtab.len;
+
+  sh = &shdrs[strtab_index];
+  sh->sh_name = buf_add_str(&shstrtab, ".strtab");
+  sh->sh_type = SHT_STRTAB;
+  sh->sh_addralign = 1;
+  sh->sh_offset = buf_add(&out, strtab.data, strtab.len);
+  sh->sh_size = strtab.len;
+
+  sh = &shdrs[shstrtab_index];
+  sh->sh_name = buf_add_str(&shstrtab, ".shstrtab");
+  sh->sh_type = SHT_STRTAB;
+  sh->sh_addralign = 1;
+  sh->sh_offset = buf_add(&out, shstrtab.data, shstrtab.len);
+  sh->sh_size = shstrtab.len;
+
+  buf_align(&out, 8);
+  int shoff = buf_add(&out, shdrs, nsec * sizeof(Elf64_Shdr));
+
+  Elf64_Ehdr* eh = (Elf64_Ehdr*)out.data;
+  memcpy(eh->e_ident, ELFMAG, SELFMAG);
+  eh->e_ident[EI_CLASS] = ELFCLASS64;
+  eh->e_ident[EI_DATA] = ELFDATA2LSB;
+  eh->e_ident[EI_VERSION] = EV_CURRENT;
+  eh->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  eh->e_type = ET_REL;
+  eh->e_machine = EM_X86_64;
+  eh->e_version = EV_CURRENT;
+  eh->e_ehsize = sizeof(Elf64_Ehdr);
+  eh->e_shentsize = sizeof(Elf64_Shdr);
+  eh->e_shnum = nsec;
+  eh->e_shstrndx = shstrtab_index;
+  eh->e_shoff = shoff;
+
+  FILE* fp = fopen(path, "wb");
+  if (!fp) error("cannot open %s: %s", path, strerror(errno));
+  fwrite(out.data, 1, out.len, fp);
+  fclose(fp);
+}
+
+// アセンブリのテキストを読んで、各セクションの中身を作る
+void parse_text(char* text) {
+  // 行ごとに区切って、その場で読んでいく
+  for (char* p = text; *p;) {
+    char* end = strchr(p, '\n');
+    if (end) *end = '\0';
+    parse_line(p);
+    if (!end) break;
+    p = end + 1;
+  }
+  layout();
+  write_sections();
+}
+
+// アセンブリのテキストを機械語に変換して、pathにオブジェクトファイルを書き出す
+void assemble(char* text, char* path) {
+  parse_text(text);
+  write_elf(path);
+}
+
+// ---- メモリ上での実行（--run） ----
+
+// 中継コード jmp [rip+0] の後に飛び先のアドレスを置く
+#define STUB_SIZE 16
+
+long page_align(long n, long page) { return (n + page - 1) / page * page; }
+
+// 再配置の対象のアドレスを求める。外部シンボルはdlsymで探す
+unsigned char* symbol_addr(void* handle, Symbol* sym) {
+  if (sym->sec) return sym->sec->addr + sym->value;
+  // glibcのatexitは静的ライブラリにしかないので、9cc自身のものを使う
+  if (!strcmp(sym->name, "atexit")) return (unsigned char*)atexit;
+  void* addr = dlsym(handle, sym->name);
+  if (!addr) error("未定義のシンボルです: %s", sym->name);
+  return addr;
+}
+
+// 再配置を適用する。外部関数は2GBより遠くにあり得るので中継コードを通す
+void apply_reloc(void* handle, Section* sec, Reloc* r) {
+  unsigned char* field = sec->addr + r->offset;
+  Symbol* sym = r->sym;
+  unsigned char* target;
+  if (!sym->sec && r->type == R_X86_64_PLT32) {
+    if (!sym->stub[0]) {
+      unsigned char* addr = symbol_addr(handle, sym);
+      memcpy(sym->stub, "\xff\x25\x00\x00\x00\x00", 6);
+      memcpy(sym->stub + 6, &addr, 8);
+    }
+    target = sym->stub;
+  } else {
+    target = symbol_addr(handle, sym);
+  }
+
+  long val = (long)target + r->addend;
+  if (r->type == R_X86_64_64) {
+    memcpy(field, &val, 8);
+    return;
+  }
+  if (r->type == R_X86_64_PC32 || r->type == R_X86_64_PLT32)
+    val -= (long)field;
+  else if (val != (unsigned)val)
+    error("32ビットに収まらないアドレスです: %s", sym->name);
+  if (val != (int)val && r->type != R_X86_64_32)
+    error("相対アドレスが32ビットに収まりません: %s", sym->name);
+  int v = val;
+  memcpy(field, &v, 4);
+}
+
+// アセンブリのテキストを機械語に変換してメモリ上に配置し、mainを呼び出す。
+// libsの共有ライブラリを先に読み込み、外部関数はdlsymで解決する
+int run_jit(char* text, char** libs, int nlibs) {
+  for (int i = 0; i < nlibs; i++)
+    if (!dlopen(libs[i], RTLD_NOW | RTLD_GLOBAL))
+      error("cannot load %s: %s", libs[i], dlerror());
+  void* handle = dlopen(NULL, RTLD_NOW);
+
+  parse_text(text);
+
+  // セクションごとにページ境界から並べて、最後に中継コードを置く
+  long page = sysconf(_SC_PAGESIZE);
+  long size = 0;
+  for (Section* sec = sections; sec; sec = sec->next)
+    if (sec->flags & SHF_ALLOC) size = page_align(size, page) + sec->size;
+  long stub_start = page_align(size, page);
+  int nstubs = 0;
+  for (Symbol* sym = all_syms; sym; sym = sym->all_next)
+    if (!sym->sec) nstubs++;
+  size = page_align(stub_start + STUB_SIZE * nstubs, page);
+
+  unsigned char* base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) error("mmap: %s", strerror(errno));
+  long offset = 0;
+  for (Section* sec = sections; sec; sec = sec->next) {
+    if (!(sec->flags & SHF_ALLOC)) continue;
+    sec->addr = base + page_align(offset, page);
+    if (sec->data) memcpy(sec->addr, sec->data, sec->size);
+    offset = sec->addr - base + sec->size;
+  }
+  unsigned char* stub = base + stub_start;
+  for (Symbol* sym = all_syms; sym; sym = sym->all_next)
+    if (!sym->sec) {
+      sym->stub = stub;
+      stub += STUB_SIZE;
+    }
+
+  for (Section* sec = sections; sec; sec = sec->next)
+    for (int i = 0; i < sec->nrelocs; i++)
+      if (sec->flags & SHF_ALLOC) apply_reloc(handle, sec, &sec->relocs[i]);
+
+  // 書き込みと実行を同時には許さないように、セクションごとに保護を変える
+  for (Section* sec = sections; sec; sec = sec->next) {
+    if (!(sec->flags & SHF_ALLOC) || !sec->size) continue;
+    int prot = PROT_READ;
+    if (sec->flags & SHF_WRITE) prot |= PROT_WRITE;
+    if (sec->flags & SHF_EXECINSTR) prot |= PROT_EXEC;
+    mprotect(sec->addr, page_align(sec->size, page), prot);
+  }
+  if (nstubs)
+    mprotect(base + stub_start, size - stub_start, PROT_READ | PROT_EXEC);
+
+  Symbol* main_sym = intern_symbol("main", 4);
+  if (!main_sym->sec || !(main_sym->sec->flags & SHF_EXECINSTR))
+    error("mainが定義されていません");
+  int (*main_fn)() = (int (*)())(main_sym->sec->addr + main_sym->value);
+  return main_fn();
+}
+
+#endif
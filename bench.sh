@@ -0,0 +1,65 @@
+#!/bin/bash
+# 9ccが生成したコードの実行時間と、9cc自身のコンパイル時間を測る
+
+TIMEFORMAT="%3R s"
+
+bench() {
+  name="$1"
+  input="$2"
+  flags="$3"
+
+  echo "$input" > tmp.c
+  ./9cc $flags tmp.c > tmp.s
+  cc -target x86_64-apple-darwin -o tmp.x tmp.s
+  printf "%-20s" "$name"
+  time ./tmp.x
+}
+
+# tmp.cのコンパイルにかかる時間を測る（字句解析、構文解析、コード生成）
+bench_compile() {
+  name="$1"
+  flags="$2"
+
+  printf "%-20s" "$name"
+  time ./9cc $flags tmp.c > /dev/null
+}
+
+# 単純なカウントループ
+bench "for-count" 'int main() { int i; int s; s = 0; for (i = 0; i < 100000000; i = i + 1) s = s + 1; return 0; }'
+bench "while-count" 'int main() { int i; i = 0; while (i < 100000000) i = i + 1; return 0; }'
+
+# 2重ループ
+bench "nested-loop" 'int main() { int i; int j; int s; s = 0; for (i = 0; i < 10000; i = i + 1) for (j = 0; j < 10000; j = j + 1) s = s + j; return 0; }'
+
+# ループ内の分岐
+bench "loop-branch" 'int main() { int i; int s; s = 0; for (i = 0; i < 100000000; i = i + 1) { if (i == 7) s = s + 1; } return s; }'
+
+# 配列の要素ごとの演算（ベクトル化される）
+bench "vector-int" 'int a[1000]; int b[1000]; int c[1000]; int main() { int r; int i; for (r = 0; r < 100000; r = r + 1) for (i = 0; i < 1000; i = i + 1) a[i] = b[i] + c[i]; return 0; }'
+bench "vector-int-avx2" 'int a[1000]; int b[1000]; int c[1000]; int main() { int r; int i; for (r = 0; r < 100000; r = r + 1) for (i = 0; i < 1000; i = i + 1) a[i] = b[i] + c[i]; return 0; }' -mavx2
+bench "vector-char" 'char a[1000]; char b[1000]; int main() { int r; int i; for (r = 0; r < 100000; r = r + 1) for (i = 0; i < 1000; i = i + 1) a[i] = b[i] - 3; return 0; }'
+bench "scalar-int" 'int a[1000]; int b[1000]; int c[1000]; int main() { int r; int i; for (r = 0; r < 100000; r = r + 1) for (i = 0; i < 1000; i = i + 1) a[i] = (b[i] + c[i]) * 1; return 0; }'
+
+# 関数呼び出しが多いコード（呼び出し時のスタックの16バイト境界の効果を見る）
+bench "call-fib" 'int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { return fib(38) * 0; }'
+bench "call-8args" 'int f(int a, int b, int c, int d, int e, int f, int g, int h) { return a + h; } int main() { int i; int s; s = 0; for (i = 0; i < 100000000; i++) s = s + f(i, 1, 2, 3, 4, 5, 6, 7); return s * 0; }'
+bench "call-libc" 'int main() { char buf[64]; int i; int s; s = 0; for (i = 0; i < 5000000; i++) s = s + snprintf(buf, 64, "%d %s", i, "abc"); return s * 0; }'
+
+# 大きな入力のコンパイル（トークナイザとパーサの速さを見る）
+# 式の多い関数を並べた約2.7MBのソース
+body=$(printf '  x = (a + b * %d - (c / 2)) * (x + 1) == y || !(z < a && b >= c);\n' $(seq 400))
+for i in $(seq 100); do
+  printf 'int f%d(int a, int b, int c) {\n  int x; int y; int z;\n  x = 0; y = 1; z = 2;\n%s\n  return x;\n}\n' "$i" "$body"
+done > tmp.c
+echo 'int main() { return f1(1, 2, 3); }' >> tmp.c
+bench_compile "compile-exprs"
+
+# 深い括弧の入れ子
+{
+  printf 'int main() { return '
+  printf '%.0s(' $(seq 100000)
+  printf '1'
+  printf '%.0s)' $(seq 100000)
+  echo '; }'
+} > tmp.c
+bench_compile "compile-parens"
@@ -2,20 +2,45 @@
 
 #include "9cc.h"
 
-int label_number = 0;
+// 引数を渡すレジスタ（System V ABI）
+char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+char* arg_regs32[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+char* arg_regs8[] = {"dil", "sil", "dl", "cl", "r8b", "r9b"};
+
+// 引数を置くcallee-savedレジスタ。関数呼び出しをまたいでも値が残る
+char* saved_regs[] = {"rbx", "r12", "r13", "r14", "r15"};
+char* saved_regs32[] = {"ebx", "r12d", "r13d", "r14d", "r15d"};
+
+// レジスタに置いた引数なら、そのsaved_regsの添え字を返す。そうでなければ-1
+int var_reg(Node* node) {
+  if (node->kind != ND_LVAR || !ctx->func) return -1;
+  for (int i = 0; i < ctx->func->params_len; i++) {
+    Node* param = ctx->func->params[i];
+    if (param->reg && param->offset == node->offset) return param->reg - 1;
+  }
+  return -1;
+}
+
 void gen_lval(Node* node) {
+  if (var_reg(node) >= 0) {
+    // レジスタに置いた変数にはアドレスがない。gen_storeはこの値を使わない
+    gen_push("rax");
+    return;
+  }
+
   if (node->kind == ND_LVAR) {
     gen_comment("ローカル変数のアドレスを取得する");
-    printf("  mov rax, rbp\n");
-    printf("  sub rax, %d\n", node->offset);
-    printf("  push rax\n");
+    fprintf(ctx->output, "  mov rax, rbp\n");
+    fprintf(ctx->output, "  sub rax, %d\n", node->offset);
+    gen_push("rax");
     return;
   }
 
   if (node->kind == ND_GVAR) {
     gen_comment("グローバル変数のアドレスを取得する");
-    printf("  lea rax, [rip + _%s]\n", node->funcname);
-    printf("  push rax\n");
+    fprintf(ctx->output, "  lea rax, [rip + " GVAR_PREFIX "%s]\n",
+            node->funcname);
+    gen_push("rax");
     return;
   }
 
@@ -24,6 +49,16 @@ void gen_lval(Node* node) {
     return;          // そのアドレスがそのまま左辺値
   }
 
+  if (node->kind == ND_MEMBER) {
+    gen_lval(node->lhs);  // 構造体のアドレスにメンバのオフセットを足す
+    if (node->member->offset) {
+      gen_pop("rax");
+      fprintf(ctx->output, "  add rax, %d\n", node->member->offset);
+      gen_push("rax");
+    }
+    return;
+  }
+
   error("代入の左辺値が変数でもポインタでもありません");
 }
 
@@ -38,323 +73,1478 @@ int size_of(Type* type) {
     case ARRAY:
       // 配列全体のサイズ
       return type->array_size * size_of(type->ptr_to);
+    case STRUCT:
+      return type->size;
   }
   error("不正な型です");
 }
 
+// 型のアラインメント。配列は要素のアラインメントに揃える
+int align_of(Type* type) {
+  if (type->ty == ARRAY) return align_of(type->ptr_to);
+  if (type->ty == STRUCT) return type->align;
+  return size_of(type);
+}
+
+// 64ビットで扱う型（ポインタ、配列）かどうか。
+// それ以外（int, char, 型が分からない値）は下位32ビットだけが意味を持つ
+bool is_wide(Type* type) {
+  return type && (type->ty == PTR || type->ty == ARRAY);
+}
+
+// 値がアドレスで表される型（配列、構造体）かどうか
+bool is_aggregate(Type* type) {
+  return type && (type->ty == ARRAY || type->ty == STRUCT);
+}
+
+// nをalignの倍数に切り上げる
+int align_to(int n, int align) { return (n + align - 1) / align * align; }
+
+// 値をスタックに積む式かどうか
+bool is_expr(Node* node) {
+  switch (node->kind) {
+    case ND_RETURN:
+    case ND_IF:
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_BLOCK:
+    case ND_DECL:
+    case ND_SWITCH:
+    case ND_CASE:
+    case ND_BREAK:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// ループやswitch文の本体を生成する。本体の中のbreakは.Lend<lend>に飛ぶ
+void gen_body(Node* body, int lend) {
+  int brk = ctx->break_label;
+  ctx->break_label = lend;
+  gen_stmt(body);
+  ctx->break_label = brk;
+}
+
+int cmp_case_val(const void* a, const void* b) {
+  Node* x = *(Node**)a;
+  Node* y = *(Node**)b;
+  return x->val < y->val ? -1 : x->val > y->val;
+}
+
+// eaxの値でcases[lo, hi)を二分探索して、一致したcaseに飛ぶ。
+// 一致しなければldefaultに飛ぶ
+void gen_case_search(Node** cases, int lo, int hi, char* ldefault) {
+  if (hi - lo <= 4) {
+    for (int i = lo; i < hi; i++) {
+      fprintf(ctx->output, "  cmp eax, %d\n", cases[i]->val);
+      fprintf(ctx->output, "  je .Lcase%d\n", cases[i]->label);
+    }
+    fprintf(ctx->output, "  jmp %s\n", ldefault);
+    return;
+  }
+  int mid = (lo + hi) / 2;
+  int lright = ctx->label_number++;
+  fprintf(ctx->output, "  cmp eax, %d\n", cases[mid]->val);
+  fprintf(ctx->output, "  je .Lcase%d\n", cases[mid]->label);
+  fprintf(ctx->output, "  jg .Lright%d\n", lright);
+  gen_case_search(cases, lo, mid, ldefault);
+  fprintf(ctx->output, ".Lright%d:\n", lright);
+  gen_case_search(cases, mid + 1, hi, ldefault);
+}
+
+// switch文。caseの値が密ならジャンプテーブルで、疎なら二分探索で分岐する
+void gen_switch(Node* node) {
+  int lend = ctx->label_number++;
+  gen_comment("SWITCH文");
+  gen(node->cond);
+  gen_pop("rax");
+
+  // caseに番号を付けて、値の順に並べる
+  int n = 0;
+  for (Node* c = node->case_next; c; c = c->case_next) n++;
+  Node** cases = arena_alloc((n + 1) * sizeof(Node*));
+  n = 0;
+  for (Node* c = node->case_next; c; c = c->case_next) {
+    c->label = ctx->label_number++;
+    cases[n++] = c;
+  }
+  qsort(cases, n, sizeof(Node*), cmp_case_val);
+
+  char ldefault[32];
+  if (node->default_case) {
+    node->default_case->label = ctx->label_number++;
+    sprintf(ldefault, ".Lcase%d", node->default_case->label);
+  } else {
+    sprintf(ldefault, ".Lend%d", lend);
+  }
+
+  // 値の範囲の3分の1以上がcaseならジャンプテーブルを使う。
+  // 表には表の先頭からの相対アドレスを置く
+  long range = n ? (long)cases[n - 1]->val - cases[0]->val + 1 : 0;
+  if (n >= 4 && range <= 3 * n) {
+    int table = ctx->label_number++;
+    fprintf(ctx->output, "  sub eax, %d\n", cases[0]->val);
+    fprintf(ctx->output, "  cmp eax, %ld\n", range - 1);
+    fprintf(ctx->output, "  ja %s\n", ldefault);
+    fprintf(ctx->output, "  lea rdi, [rip + .Ltable%d]\n", table);
+    fprintf(ctx->output, "  movsxd rax, DWORD PTR [rdi + rax*4]\n");
+    fprintf(ctx->output, "  add rax, rdi\n");
+    fprintf(ctx->output, "  jmp rax\n");
+
+    fprintf(ctx->rodata_out, "  .p2align 2\n");
+    fprintf(ctx->rodata_out, ".Ltable%d:\n", table);
+    for (int i = 0, v = cases[0]->val; i < n; v++) {
+      if (cases[i]->val == v)
+        fprintf(ctx->rodata_out, "  .long .Lcase%d - .Ltable%d\n",
+                cases[i++]->label, table);
+      else
+        fprintf(ctx->rodata_out, "  .long %s - .Ltable%d\n", ldefault,
+                table);
+    }
+  } else {
+    gen_case_search(cases, 0, n, ldefault);
+  }
+
+  gen_body(node->body, lend);
+  fprintf(ctx->output, ".Lend%d:\n", lend);
+}
+
+// raxの戻り値を保ったまま関数から戻る。
+// -finstrumentのときは、入ってからのサイクル数を計測表に足す
+void gen_epilogue() {
+  if (ctx->opt_instrument) {
+    int k = ctx->func_index;
+    fprintf(ctx->output, "  mov r8, rax\n");
+    fprintf(ctx->output, "  rdtsc\n");
+    fprintf(ctx->output, "  shl rdx, 32\n");
+    fprintf(ctx->output, "  or rax, rdx\n");
+    fprintf(ctx->output, "  sub rax, [rbp-%d]\n", ctx->prof_offset);
+    fprintf(ctx->output, "  add [rip + .L.prof + %d], rax\n", 16 * k + 8);
+    fprintf(ctx->output, "  mov rax, r8\n");
+  }
+  for (int i = 0; i < ctx->nsaved; i++)
+    fprintf(ctx->output, "  mov %s, [rbp-%d]\n", saved_regs[i],
+            ctx->save_offset - 8 * i);
+  fprintf(ctx->output, "  mov rsp, rbp\n");
+  fprintf(ctx->output, "  pop rbp\n");  // rbpを戻す
+  fprintf(ctx->output, "  ret\n");
+}
+
+// 文を生成する。式文の値は捨てて、スタックの深さを元に戻す
+void gen_stmt(Node* node) {
+  gen_loc(node);
+  if (is_assign_op(node)) {
+    gen_assign_op(node, false);
+    return;
+  }
+  gen(node);
+  if (is_expr(node)) gen_pop("rax");
+}
+
+bool is_assign_op(Node* node) {
+  switch (node->kind) {
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// ローカル変数かグローバル変数なら、そのメモリオペランドをbufに書く
+bool var_operand(Node* node, char* buf) {
+  if (node->kind == ND_LVAR) {
+    sprintf(buf, "[rbp-%d]", node->offset);
+    return true;
+  }
+  if (node->kind == ND_GVAR) {
+    sprintf(buf, "[rip + " GVAR_PREFIX "%s]", node->funcname);
+    return true;
+  }
+  return false;
+}
+
+// 複合代入と++/--。左辺のアドレスは一度だけ計算し、
+// 値を使わない足し引きはメモリを直接書き換える1命令にする。
+// use_valueがtrueなら式の値をスタックに積む
+void gen_assign_op(Node* node, bool use_value) {
+  Node* lhs = node->lhs;
+  if (var_reg(lhs) >= 0) {
+    gen_reg_assign_op(node, use_value);
+    return;
+  }
+
+  bool post = node->kind == ND_POST_INC || node->kind == ND_POST_DEC;
+  bool add = node->kind == ND_ADD_ASSIGN || node->kind == ND_POST_INC;
+  bool sub = node->kind == ND_SUB_ASSIGN || node->kind == ND_POST_DEC;
+  bool wide = is_wide(lhs->type);
+  int scale = wide ? size_of(lhs->type->ptr_to) : 1;
+  bool is_char = lhs->type && lhs->type->ty == CHAR;
+  char* size = is_char ? "BYTE" : wide ? "QWORD" : "DWORD";
+  char mem[128];
+
+  // 変数に定数を足し引きするなら、アドレスをレジスタに置く必要もない
+  if ((add || sub) && !use_value && node->rhs->kind == ND_NUM &&
+      var_operand(lhs, mem)) {
+    fprintf(ctx->output, "  %s %s PTR %s, %ld\n", add ? "add" : "sub", size,
+            mem, (long)node->rhs->val * scale);
+    return;
+  }
+
+  gen_lval(lhs);
+  gen(node->rhs);
+  gen_pop("rdi");
+  gen_pop("rax");
+  if (wide) {
+    fprintf(ctx->output, "  movsxd rdi, edi\n");
+    if (scale != 1) fprintf(ctx->output, "  imul rdi, %d\n", scale);
+  }
+
+  if ((add || sub) && !use_value) {
+    fprintf(ctx->output, "  %s %s PTR [rax], %s\n", add ? "add" : "sub", size,
+            is_char ? "dil" : wide ? "rdi" : "edi");
+    return;
+  }
+
+  // 読み出して計算し、書き戻す。後置ならrdxに変更前の値を残す
+  fprintf(ctx->output, "  mov rsi, rax\n");
+  gen_load(lhs->type);
+  if (post) fprintf(ctx->output, "  mov rdx, rax\n");
+  if (add) {
+    fprintf(ctx->output, wide ? "  add rax, rdi\n" : "  add eax, edi\n");
+  } else if (sub) {
+    fprintf(ctx->output, wide ? "  sub rax, rdi\n" : "  sub eax, edi\n");
+  } else if (node->kind == ND_MUL_ASSIGN) {
+    fprintf(ctx->output, "  imul eax, edi\n");
+  } else {
+    fprintf(ctx->output, "  cdq\n");
+    fprintf(ctx->output, "  idiv edi\n");
+  }
+  if (is_char) fprintf(ctx->output, "  movsx eax, al\n");
+  fprintf(ctx->output, "  mov rdi, rax\n");
+  fprintf(ctx->output, "  mov rax, rsi\n");
+  gen_store(lhs);
+  if (use_value) gen_push(post ? "rdx" : "rdi");
+}
+
+// レジスタに置いた変数の複合代入と++/--。レジスタを直接書き換える
+void gen_reg_assign_op(Node* node, bool use_value) {
+  Node* lhs = node->lhs;
+  int r = var_reg(lhs);
+  bool wide = is_wide(lhs->type);
+  int scale = wide ? size_of(lhs->type->ptr_to) : 1;
+  char* reg = wide ? saved_regs[r] : saved_regs32[r];
+  char* src = wide ? "rdi" : "edi";
+  bool post = node->kind == ND_POST_INC || node->kind == ND_POST_DEC;
+  bool add = node->kind == ND_ADD_ASSIGN || node->kind == ND_POST_INC;
+  bool sub = node->kind == ND_SUB_ASSIGN || node->kind == ND_POST_DEC;
+  bool imm = (add || sub) && node->rhs->kind == ND_NUM;
+
+  if (!imm) {
+    gen(node->rhs);
+    gen_pop("rdi");
+    if (wide) {
+      fprintf(ctx->output, "  movsxd rdi, edi\n");
+      if (scale != 1) fprintf(ctx->output, "  imul rdi, %d\n", scale);
+    }
+  }
+  // 後置ならrdxに変更前の値を残す
+  if (post) fprintf(ctx->output, "  mov rdx, %s\n", saved_regs[r]);
+
+  if (imm) {
+    fprintf(ctx->output, "  %s %s, %ld\n", add ? "add" : "sub", reg,
+            (long)node->rhs->val * scale);
+  } else if (add || sub) {
+    fprintf(ctx->output, "  %s %s, %s\n", add ? "add" : "sub", reg, src);
+  } else if (node->kind == ND_MUL_ASSIGN) {
+    fprintf(ctx->output, "  imul %s, edi\n", reg);
+  } else {
+    fprintf(ctx->output, "  mov eax, %s\n", reg);
+    fprintf(ctx->output, "  cdq\n");
+    fprintf(ctx->output, "  idiv edi\n");
+    fprintf(ctx->output, "  mov %s, eax\n", reg);
+  }
+  if (use_value)
+    gen_push(post ? "rdx" : saved_regs[r]);
+}
+
+// 変数、定数、変数のアドレスの引数かどうか。
+// これらはスタックを経由せずに引数のレジスタに直接読み込める
+bool is_simple_arg(Node* node) {
+  switch (node->kind) {
+    case ND_NUM:
+    case ND_STR:
+    case ND_LVAR:
+    case ND_GVAR:
+      return true;
+    case ND_ADDR:
+      return node->lhs->kind == ND_LVAR || node->lhs->kind == ND_GVAR;
+    default:
+      return false;
+  }
+}
+
+// 単純な引数をi番目の引数のレジスタに直接読み込む
+void gen_arg(Node* node, int i) {
+  char mem[128];
+  int r = var_reg(node);
+  if (node->kind == ND_NUM) {
+    fprintf(ctx->output, "  mov %s, %d\n", arg_regs[i], node->val);
+  } else if (node->kind == ND_STR) {
+    fprintf(ctx->output, "  lea %s, [rip + .L.str%d]\n", arg_regs[i],
+            node->str_label);
+  } else if (r >= 0) {
+    fprintf(ctx->output, "  mov %s, %s\n", arg_regs[i], saved_regs[r]);
+  } else if (node->kind == ND_ADDR || is_aggregate(node->type)) {
+    // 配列は先頭のアドレスを渡す
+    var_operand(node->kind == ND_ADDR ? node->lhs : node, mem);
+    fprintf(ctx->output, "  lea %s, %s\n", arg_regs[i], mem);
+  } else {
+    var_operand(node, mem);
+    if (node->type->ty == CHAR)
+      fprintf(ctx->output, "  movsx %s, BYTE PTR %s\n", arg_regs32[i], mem);
+    else if (node->type->ty == PTR)
+      fprintf(ctx->output, "  mov %s, %s\n", arg_regs[i], mem);
+    else
+      fprintf(ctx->output, "  mov %s, DWORD PTR %s\n", arg_regs32[i], mem);
+  }
+}
+
+// 関数呼び出し。7番目以降の引数は後ろから順にスタックに積む。
+// 計算の必要な引数を先に評価してから、単純な引数をレジスタに直接読み込む
+void gen_call(Node* node) {
+  int nargs = node->stmts_len;
+  int nregs = nargs < 6 ? nargs : 6;
+  int nstack = nargs - nregs;
+
+  // ABIはcall命令の時点でrspが16バイト境界にあることを求める。
+  // 評価中の値とスタックに積む引数の数が奇数なら8バイト空ける
+  int pad = (ctx->depth + nstack) % 2;
+  if (pad) {
+    fprintf(ctx->output, "  sub rsp, 8\n");
+    ctx->depth++;
+  }
+  for (int i = nargs - 1; i >= 6; i--) gen(node->stmts[i]);
+
+  for (int i = 0; i < nregs; i++)
+    if (!is_simple_arg(node->stmts[i])) gen(node->stmts[i]);
+  for (int i = nregs - 1; i >= 0; i--)
+    if (!is_simple_arg(node->stmts[i]))
+      gen_pop(arg_regs[i]);
+  for (int i = 0; i < nregs; i++)
+    if (is_simple_arg(node->stmts[i])) gen_arg(node->stmts[i], i);
+
+  // System V ABIの規約: 可変長引数関数を呼ぶ時は、
+  // ベクトルレジスタで渡される浮動小数点引数の個数をALに入れる
+  // 浮動小数点数がないので常に0
+  fprintf(ctx->output, "  mov al, 0\n");
+  // 展開できなかった組み込み関数はライブラリ関数を呼ぶ
+  char* name = node->funcname;
+  if (!strncmp(name, "__builtin_", strlen("__builtin_")))
+    name += strlen("__builtin_");
+  fprintf(ctx->output, "  call " SYM_PREFIX "%s\n", name);
+  if (nstack + pad) {
+    fprintf(ctx->output, "  add rsp, %d\n", 8 * (nstack + pad));
+    ctx->depth -= nstack + pad;
+  }
+  gen_push("rax");  // 関数の戻り値をスタックにプッシュ
+}
+
+// 続く命令がソースのどの行から生成されたかを.locで示す。
+// 行が変わったときだけ出力し、それ自体は命令にならない文では出力しない
+void gen_loc(Node* node) {
+  if (!node->line || node->line == ctx->loc_line) return;
+  if (node->kind == ND_DECL || node->kind == ND_BLOCK) return;
+  fprintf(ctx->output, "  .loc 1 %d %d\n", node->line, node->col);
+  ctx->loc_line = node->line;
+}
+
+// ifのthen節を生成する。-finstrumentのときは条件が真だった回数を数える
+void gen_then(Node* node) {
+  if (ctx->opt_instrument)
+    fprintf(ctx->output, "  inc QWORD PTR [rip + .L.prof.br + %d]\n",
+            16 * (ctx->branch_base + node->branch_id) + 8);
+  gen_stmt(node->then);
+}
+
+// raxとrdiに入った比較演算の両辺を比べる。
+// int同士は32ビットで、ポインタが絡む場合はintの側を符号拡張して64ビットで比べる
+void gen_cmp(Node* node) {
+  if (!is_wide(node->lhs->type) && !is_wide(node->rhs->type)) {
+    fprintf(ctx->output, "  cmp eax, edi\n");
+    return;
+  }
+  if (!is_wide(node->lhs->type)) fprintf(ctx->output, "  movsxd rax, eax\n");
+  if (!is_wide(node->rhs->type)) fprintf(ctx->output, "  movsxd rdi, edi\n");
+  fprintf(ctx->output, "  cmp rax, rdi\n");
+}
+
+// 条件式の値の真偽がtruthと一致したら.L<label><num>にジャンプする。
+// 比較演算は0/1の値を作らずに、cmpの結果で直接分岐する。
+// &&と||は結果が決まった時点で行き先に飛び、残りの被演算子を評価しない
+void gen_branch(Node* cond, bool truth, char* label, int num) {
+  if (cond->kind == ND_NUM) {
+    if ((cond->val != 0) == truth)
+      fprintf(ctx->output, "  jmp .L%s%d\n", label, num);
+    return;
+  }
+
+  if (cond->kind == ND_NOT) {
+    gen_branch(cond->lhs, !truth, label, num);
+    return;
+  }
+
+  // a && bが偽になる（a || bが真になる）のは、どちらかの被演算子がそうなるとき
+  if ((cond->kind == ND_LOGAND && !truth) ||
+      (cond->kind == ND_LOGOR && truth)) {
+    gen_branch(cond->lhs, truth, label, num);
+    gen_branch(cond->rhs, truth, label, num);
+    return;
+  }
+
+  // そうでなければ、左辺で結果が決まったときは右辺を飛ばす
+  if (cond->kind == ND_LOGAND || cond->kind == ND_LOGOR) {
+    int skip = ctx->label_number++;
+    gen_branch(cond->lhs, !truth, "skip", skip);
+    gen_branch(cond->rhs, truth, label, num);
+    fprintf(ctx->output, ".Lskip%d:\n", skip);
+    return;
+  }
+
+  char* jcc = NULL;
+  switch (cond->kind) {
+    case ND_EQ:
+      jcc = truth ? "je" : "jne";
+      break;
+    case ND_NE:
+      jcc = truth ? "jne" : "je";
+      break;
+    case ND_LT:
+      jcc = truth ? "jl" : "jge";
+      break;
+    case ND_LE:
+      jcc = truth ? "jle" : "jg";
+      break;
+    default:
+      break;
+  }
+
+  if (jcc) {
+    gen(cond->lhs);
+    gen(cond->rhs);
+    gen_pop("rdi");
+    gen_pop("rax");
+    gen_cmp(cond);
+    fprintf(ctx->output, "  %s .L%s%d\n", jcc, label, num);
+    return;
+  }
+
+  gen(cond);
+  gen_pop("rax");
+  fprintf(ctx->output, "  cmp %s, 0\n", is_wide(cond->type) ? "rax" : "eax");
+  fprintf(ctx->output, "  %s .L%s%d\n", truth ? "jne" : "je", label, num);
+}
+
+// スタックに値を積む。関数呼び出しの時点でrspを16バイト境界に
+// 揃えられるように、関数本体で積んでいる値の数をctx->depthで数える
+void gen_push(char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  fprintf(ctx->output, "  push ");
+  vfprintf(ctx->output, fmt, args);
+  va_end(args);
+  fprintf(ctx->output, "\n");
+  ctx->depth++;
+}
+
+void gen_pop(char* reg) {
+  fprintf(ctx->output, "  pop %s\n", reg);
+  ctx->depth--;
+}
+
 void gen_comment(const char* format, ...) {
-  printf("# ");
+  fprintf(ctx->output, "# ");
   va_list args;
   va_start(args, format);
-  vprintf(format, args);  // 可変引数を処理
+  vfprintf(ctx->output, format, args);  // 可変引数を処理
   va_end(args);
-  printf("\n");
+  fprintf(ctx->output, "\n");
+}
+
+// raxのアドレスから型に応じたサイズで値を読み込む
+void gen_load(Type* type) {
+  // 配列と構造体はアドレスのまま値として扱う
+  if (is_aggregate(type)) return;
+  if (type && type->ty == CHAR) {
+    // char型は1バイトとして符号拡張して読み込む
+    fprintf(ctx->output, "  movsx eax, BYTE PTR [rax]\n");
+  } else if (type && type->ty == PTR) {
+    // ポインタは8バイト
+    fprintf(ctx->output, "  mov rax, [rax]\n");
+  } else {
+    // intは4バイト
+    fprintf(ctx->output, "  mov eax, DWORD PTR [rax]\n");
+  }
+}
+
+// これより大きいメモリのコピーと埋め込みは、展開せずにrep movsb/stosbで行う
+#define INLINE_MEM_MAX 128
+
+// 初期値の要素をtypeの大きさのデータとしてfpに出力する。
+// 要素が足りない分は0で埋める
+void gen_data(FILE* fp, Type* type, Node** elems, int n) {
+  Type* elem = type->ty == ARRAY ? type->ptr_to : type;
+  int size = size_of(elem);
+  for (int i = 0; i < n; i++) {
+    char* label;
+    long val = eval_reloc(elems[i], &label);
+    if (size == 1)
+      fprintf(fp, "  .byte %ld\n", val & 0xff);
+    else if (size == 4)
+      fprintf(fp, "  .long %ld\n", (long)(int)val);
+    else if (label && val)
+      fprintf(fp, "  .quad %s%+ld\n", label, val);
+    else if (label)
+      fprintf(fp, "  .quad %s\n", label);
+    else
+      fprintf(fp, "  .quad %ld\n", val);
+  }
+  if (size_of(type) > n * size)
+    fprintf(fp, "  .zero %d\n", size_of(type) - n * size);
+}
+
+// rdiが指すsizeバイトをraxが指す先にコピーする。raxは変えない。
+// 小さいコピーはxmm（-mavx2ならymm）レジスタと汎用レジスタでの
+// 移動に展開し、大きいコピーはrep movsbに任せる
+void gen_copy(int size) {
+  if (size > INLINE_MEM_MAX) {
+    fprintf(ctx->output, "  mov rsi, rdi\n");
+    fprintf(ctx->output, "  mov rdi, rax\n");
+    fprintf(ctx->output, "  mov rcx, %d\n", size);
+    fprintf(ctx->output, "  rep movsb\n");
+    return;
+  }
+
+  int off = 0;
+  char* v = ctx->opt_avx2 ? "v" : "";
+  for (; ctx->opt_avx2 && size - off >= 32; off += 32) {
+    fprintf(ctx->output, "  vmovdqu ymm0, YMMWORD PTR [rdi+%d]\n", off);
+    fprintf(ctx->output, "  vmovdqu YMMWORD PTR [rax+%d], ymm0\n", off);
+  }
+  for (; size - off >= 16; off += 16) {
+    fprintf(ctx->output, "  %smovdqu xmm0, XMMWORD PTR [rdi+%d]\n", v, off);
+    fprintf(ctx->output, "  %smovdqu XMMWORD PTR [rax+%d], xmm0\n", v, off);
+  }
+  if (ctx->opt_avx2 && size >= 32) fprintf(ctx->output, "  vzeroupper\n");
+
+  char* regs[] = {"dl", "dx", "edx", "rdx"};
+  char* sizes[] = {"BYTE", "WORD", "DWORD", "QWORD"};
+  for (int i = 3; i >= 0; i--) {
+    for (; size - off >= (1 << i); off += 1 << i) {
+      fprintf(ctx->output, "  mov %s, %s PTR [rdi+%d]\n", regs[i], sizes[i],
+              off);
+      fprintf(ctx->output, "  mov %s PTR [rax+%d], %s\n", sizes[i], off,
+              regs[i]);
+    }
+  }
+}
+
+// raxが指すsizeバイトをvalの下位1バイトで埋める。raxは変えない。
+// valが定数でなければ、その値はsilに入っている
+void gen_fill(int size, Node* val) {
+  bool is_const = val->kind == ND_NUM;
+  if (size > INLINE_MEM_MAX) {
+    fprintf(ctx->output, "  mov rdx, rax\n");
+    fprintf(ctx->output, "  mov rdi, rax\n");
+    if (is_const)
+      fprintf(ctx->output, "  mov eax, %d\n", val->val & 0xff);
+    else
+      fprintf(ctx->output, "  movzx eax, sil\n");
+    fprintf(ctx->output, "  mov rcx, %d\n", size);
+    fprintf(ctx->output, "  rep stosb\n");
+    fprintf(ctx->output, "  mov rax, rdx\n");
+    return;
+  }
+
+  // 値のバイトを8つ並べたものをrdxに作り、16バイト以上なら
+  // xmm0（-mavx2ならymm0）にも並べる
+  bool zero = is_const && (val->val & 0xff) == 0;
+  if (zero) {
+    fprintf(ctx->output, "  xor edx, edx\n");
+  } else if (is_const) {
+    fprintf(ctx->output, "  mov rdx, %ld\n",
+            (long)((val->val & 0xff) * 0x0101010101010101UL));
+  } else {
+    fprintf(ctx->output, "  movzx edx, sil\n");
+    fprintf(ctx->output, "  mov rcx, 0x0101010101010101\n");
+    fprintf(ctx->output, "  imul rdx, rcx\n");
+  }
+  if (size >= 16) {
+    if (zero && ctx->opt_avx2) {
+      fprintf(ctx->output, "  vpxor xmm0, xmm0, xmm0\n");
+    } else if (zero) {
+      fprintf(ctx->output, "  pxor xmm0, xmm0\n");
+    } else if (ctx->opt_avx2) {
+      fprintf(ctx->output, "  vmovq xmm0, rdx\n");
+      fprintf(ctx->output, "  vpbroadcastq ymm0, xmm0\n");
+    } else {
+      fprintf(ctx->output, "  movq xmm0, rdx\n");
+      fprintf(ctx->output, "  pshufd xmm0, xmm0, 0x44\n");
+    }
+  }
+
+  int off = 0;
+  char* v = ctx->opt_avx2 ? "v" : "";
+  for (; ctx->opt_avx2 && size - off >= 32; off += 32)
+    fprintf(ctx->output, "  vmovdqu YMMWORD PTR [rax+%d], ymm0\n", off);
+  for (; size - off >= 16; off += 16)
+    fprintf(ctx->output, "  %smovdqu XMMWORD PTR [rax+%d], xmm0\n", v, off);
+  if (ctx->opt_avx2 && size >= 16) fprintf(ctx->output, "  vzeroupper\n");
+
+  char* regs[] = {"dl", "dx", "edx", "rdx"};
+  char* sizes[] = {"BYTE", "WORD", "DWORD", "QWORD"};
+  for (int i = 3; i >= 0; i--)
+    for (; size - off >= (1 << i); off += 1 << i)
+      fprintf(ctx->output, "  mov %s PTR [rax+%d], %s\n", sizes[i], off,
+              regs[i]);
+}
+
+// 大きさが定数のmemsetとmemcpyを、関数を呼ばずに展開する。
+// 引数の数や型が合わなければ展開しない。展開したらtrueを返す
+bool gen_mem_builtin(Node* node) {
+  bool is_set = !strcmp(node->funcname, "__builtin_memset");
+  bool is_cpy = !strcmp(node->funcname, "__builtin_memcpy");
+  if ((!is_set && !is_cpy) || node->stmts_len != 3 ||
+      !is_pointer(node->stmts[0]->type) ||
+      (is_cpy && !is_pointer(node->stmts[1]->type)) ||
+      node->stmts[2]->kind != ND_NUM || node->stmts[2]->val < 0)
+    return false;
+
+  int size = node->stmts[2]->val;
+  gen_comment("%sの展開（%dバイト）", node->funcname, size);
+  gen(node->stmts[0]);
+  if (is_cpy) {
+    gen(node->stmts[1]);
+    gen_pop("rdi");
+    gen_pop("rax");
+    gen_copy(size);
+  } else if (node->stmts[1]->kind == ND_NUM) {
+    gen_pop("rax");
+    gen_fill(size, node->stmts[1]);
+  } else {
+    gen(node->stmts[1]);
+    gen_pop("rsi");
+    gen_pop("rax");
+    gen_fill(size, node->stmts[1]);
+  }
+  // 戻り値は書き込み先のアドレス
+  gen_push("rax");
+  return true;
+}
+
+// raxのアドレスにrdiの値を左辺の型に応じたサイズで書き込む
+void gen_store(Node* lhs) {
+  int r = var_reg(lhs);
+  if (r >= 0) {
+    fprintf(ctx->output, "  mov %s, %s\n",
+            lhs->type->ty == PTR ? saved_regs[r] : saved_regs32[r],
+            lhs->type->ty == PTR ? "rdi" : "edi");
+  } else if (lhs->type && lhs->type->ty == CHAR) {
+    // char型は1バイト
+    gen_comment("char型への代入");
+    fprintf(ctx->output, "  mov [rax], dil\n");
+  } else if (lhs->type && lhs->type->ty == PTR) {
+    // ポインタ型への代入は8バイト
+    fprintf(ctx->output, "  mov [rax], rdi\n");
+  } else {
+    // int型への代入は4バイト
+    fprintf(ctx->output, "  mov [rax], edi\n");
+  }
+}
+
+// ループ不変なスカラーをraxから全要素にコピーする
+void gen_broadcast(int elem_size, int reg) {
+  if (ctx->opt_avx2) {
+    fprintf(ctx->output, "  vmovd xmm%d, eax\n", reg);
+    fprintf(ctx->output, "  vpbroadcast%c ymm%d, xmm%d\n",
+            elem_size == 4 ? 'd' : 'b', reg, reg);
+    return;
+  }
+  if (elem_size == 1) {
+    // 下位1バイトを4バイトに並べてから、4バイト単位でコピーする
+    fprintf(ctx->output, "  movzx eax, al\n");
+    fprintf(ctx->output, "  imul eax, eax, 0x01010101\n");
+  }
+  fprintf(ctx->output, "  movd xmm%d, eax\n", reg);
+  fprintf(ctx->output, "  pshufd xmm%d, xmm%d, 0\n", reg, reg);
+}
+
+// ベクトル化されたループを生成する。ループ変数が終了値に届かない
+// 残りの要素は、後に続く元のループがスカラーで処理する
+//
+//   rcx: ループ変数  r11: 終了値  r8: 書き込み先  r9, r10: 読み出し元
+//   xmm4, xmm5 (ymm4, ymm5): 読み出し元がスカラーの場合にその値を並べたもの
+void gen_vector_loop(VecLoop* vec) {
+  int width = ctx->opt_avx2 ? 32 : 16;
+  int lanes = width / vec->elem_size;
+  char* reg = ctx->opt_avx2 ? "ymm" : "xmm";
+  char* v = ctx->opt_avx2 ? "v" : "";
+  char sfx = vec->elem_size == 4 ? 'd' : 'b';
+  char* src_regs[] = {"r9", "r10"};
+  int lbegin = ctx->label_number++;
+  int lend = ctx->label_number++;
+  int lscalar = ctx->label_number++;
+
+  gen_comment("ベクトル化されたループ（%d要素ずつ）", lanes);
+  gen(vec->limit);
+  gen_pop("r11");
+  fprintf(ctx->output, "  movsxd r11, r11d\n");
+  if (vec->inclusive) fprintf(ctx->output, "  add r11, 1\n");
+  gen(vec->index);
+  gen_pop("rcx");
+  fprintf(ctx->output, "  movsxd rcx, ecx\n");
+  gen(vec->dst);
+  gen_pop("r8");
+  for (int i = 0; i < vec->nsrc; i++) {
+    gen(vec->src[i]);
+    if (vec->is_array[i]) {
+      gen_pop(src_regs[i]);
+    } else {
+      gen_pop("rax");
+      gen_broadcast(vec->elem_size, 4 + i);
+    }
+  }
+
+  // ポインタが重なっていて、書き込んだ要素を同じベクトル内で読む
+  // （0 < 書き込み先 - 読み出し元 < ベクトル幅）場合はスカラーで処理する
+  for (int i = 0; i < vec->nsrc; i++) {
+    if (!vec->is_array[i] || vec->src[i] == vec->dst ||
+        (vec->dst->type->ty != PTR && vec->src[i]->type->ty != PTR))
+      continue;
+    gen_comment("エイリアスの検査");
+    fprintf(ctx->output, "  lea rax, [r8 - 1]\n");
+    fprintf(ctx->output, "  sub rax, %s\n", src_regs[i]);
+    fprintf(ctx->output, "  cmp rax, %d\n", width - 1);
+    fprintf(ctx->output, "  jb .Lscalar%d\n", lscalar);
+  }
+
+  fprintf(ctx->output, "  lea rax, [rcx + %d]\n", lanes);
+  fprintf(ctx->output, "  cmp rax, r11\n");
+  fprintf(ctx->output, "  jg .Lvend%d\n", lend);
+  if (!ctx->cold) fprintf(ctx->output, "  .p2align 4\n");
+  fprintf(ctx->output, ".Lvbegin%d:\n", lbegin);
+  for (int i = 0; i < vec->nsrc; i++) {
+    if (vec->is_array[i])
+      fprintf(ctx->output, "  %smovdqu %s%d, [%s + rcx*%d]\n", v, reg, i,
+              src_regs[i], vec->elem_size);
+    else
+      fprintf(ctx->output, "  %smovdqa %s%d, %s%d\n", v, reg, i, reg, 4 + i);
+  }
+  if (vec->nsrc == 2) {
+    char* op = vec->op == ND_ADD   ? "padd"
+               : vec->op == ND_SUB ? "psub"
+                                   : "pmull";
+    if (ctx->opt_avx2)
+      fprintf(ctx->output, "  v%s%c ymm0, ymm0, ymm1\n", op, sfx);
+    else
+      fprintf(ctx->output, "  %s%c xmm0, xmm1\n", op, sfx);
+  }
+  fprintf(ctx->output, "  %smovdqu [r8 + rcx*%d], %s0\n", v, vec->elem_size,
+          reg);
+  fprintf(ctx->output, "  add rcx, %d\n", lanes);
+  fprintf(ctx->output, "  lea rax, [rcx + %d]\n", lanes);
+  fprintf(ctx->output, "  cmp rax, r11\n");
+  fprintf(ctx->output, "  jle .Lvbegin%d\n", lbegin);
+  fprintf(ctx->output, ".Lvend%d:\n", lend);
+
+  // 処理した要素数だけループ変数を進める
+  gen_lval(vec->index);
+  gen_pop("rax");
+  fprintf(ctx->output, "  mov rdi, rcx\n");
+  gen_store(vec->index);
+  fprintf(ctx->output, ".Lscalar%d:\n", lscalar);
+  if (ctx->opt_avx2) fprintf(ctx->output, "  vzeroupper\n");
 }
 
 void gen(Node* node) {
   if (node->kind == ND_FUNC) {
-    // 関数定義のコード生成
-    printf("\n_%s:\n", node->funcname);
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    printf("  sub rsp, 208\n");  // ローカル変数用のスタック領域を確保
-
-    // 引数をスタックに保存（x86-64呼び出し規約に従う）
-    char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    for (int i = 0; i < node->params_len && i < 6; i++) {
-      // 引数をメモリに保存（すべて8バイトとして扱う）
-      printf("  mov [rbp-%d], %s\n", node->params[i]->offset, arg_regs[i]);
+    // 関数定義のコード生成。ほとんど呼ばれない関数以外は、
+    // 命令フェッチの単位に合わせて先頭を16バイト境界に置く
+    fprintf(ctx->output, "\n");
+    if (!ctx->has_profile || node->count)
+      fprintf(ctx->output, "  .p2align 4\n");
+    fprintf(ctx->output, SYM_PREFIX "%s:\n", node->funcname);
+    ctx->func = node;
+    ctx->depth = 0;
+    ctx->loc_line = 0;
+    ctx->break_label = -1;
+    gen_loc(node);
+    fprintf(ctx->output, "  push rbp\n");
+    fprintf(ctx->output, "  mov rbp, rsp\n");
+    if (ctx->opt_instrument) {
+      // 入った時刻を保存する領域を確保する
+      node->stack_size = align_to(node->stack_size, 8) + 8;
+      ctx->prof_offset = node->stack_size;
+    }
+    // 引数を置くcallee-savedレジスタの退避先を確保
+    ctx->nsaved = 0;
+    for (int i = 0; i < node->params_len; i++)
+      if (node->params[i]->reg) ctx->nsaved++;
+    if (ctx->nsaved) {
+      node->stack_size = align_to(node->stack_size, 8) + 8 * ctx->nsaved;
+      ctx->save_offset = node->stack_size;
+    }
+    // ローカル変数用のスタック領域を確保
+    fprintf(ctx->output, "  sub rsp, %d\n", align_to(node->stack_size, 16));
+    for (int i = 0; i < ctx->nsaved; i++)
+      fprintf(ctx->output, "  mov [rbp-%d], %s\n", ctx->save_offset - 8 * i,
+              saved_regs[i]);
+
+    // 引数をレジスタかスタックの変数に移す（x86-64呼び出し規約に従う）。
+    // 7番目以降の引数は呼び出し元がスタックに積んでいるので、raxを経由する
+    for (int i = 0; i < node->params_len; i++) {
+      Node* param = node->params[i];
+      Type* type = param->type;
+      char* reg64 = i < 6 ? arg_regs[i] : "rax";
+      char* reg32 = i < 6 ? arg_regs32[i] : "eax";
+      char* reg8 = i < 6 ? arg_regs8[i] : "al";
+      if (i >= 6)
+        fprintf(ctx->output, "  mov rax, [rbp+%d]\n", 16 + 8 * (i - 6));
+      if (param->reg) {
+        int r = param->reg - 1;
+        if (type->ty == PTR)
+          fprintf(ctx->output, "  mov %s, %s\n", saved_regs[r], reg64);
+        else
+          fprintf(ctx->output, "  mov %s, %s\n", saved_regs32[r], reg32);
+        continue;
+      }
+      // 引数を型のサイズでメモリに保存
+      char* reg = type->ty == CHAR ? reg8 : type->ty == PTR ? reg64 : reg32;
+      fprintf(ctx->output, "  mov [rbp-%d], %s\n", param->offset, reg);
+    }
+
+    // atexitの呼び出しとrdtscは引数のレジスタを書き換えるので、
+    // 引数を保存してから計測を始める
+    if (ctx->opt_instrument) {
+      int k = ctx->func_index;
+      // mainから終了時に計測結果を書き出すように登録する
+      if (!strcmp(node->funcname, "main")) {
+        fprintf(ctx->output, "  lea rdi, [rip + .L.prof_dump]\n");
+        fprintf(ctx->output, "  call " SYM_PREFIX "atexit\n");
+      }
+      gen_comment("呼び出し回数を数えて、入った時刻を保存する");
+      fprintf(ctx->output, "  inc QWORD PTR [rip + .L.prof + %d]\n", 16 * k);
+      fprintf(ctx->output, "  rdtsc\n");
+      fprintf(ctx->output, "  shl rdx, 32\n");
+      fprintf(ctx->output, "  or rax, rdx\n");
+      fprintf(ctx->output, "  mov [rbp-%d], rax\n", ctx->prof_offset);
     }
 
     // 関数本体を生成
+    // 計測結果で一度も呼ばれていない関数は、全体をほとんど実行されない
+    // コードとして扱う
+    char* cold_buf;
+    size_t cold_len;
+    ctx->cold_out = open_memstream(&cold_buf, &cold_len);
+    ctx->cold = ctx->has_profile && node->count == 0;
     gen(node->body);
+
+    // 本体の最後まで実行したときは、最後の式文の値を返す
+    gen_epilogue();
+
+    // 後ろに回した節を置く
+    fclose(ctx->cold_out);
+    fputs(cold_buf, ctx->output);
+    free(cold_buf);
+    ctx->cold = false;
     return;
   }
 
   if (node->kind == ND_BLOCK) {
-    for (int i = 0; i < node->stmts_len; i++) {
-      gen(node->stmts[i]);
-      // return文と変数の宣言以外の場合のみpopする
-      if (node->stmts[i]->kind != ND_RETURN &&
-          node->stmts[i]->kind != ND_DECL) {
-        printf("  pop rax\n");
-      }
-    }
+    for (int i = 0; i < node->stmts_len; i++) gen_stmt(node->stmts[i]);
     return;
   }
 
   if (node->kind == ND_RETURN) {
     gen(node->lhs);
     gen_comment("リターンする");
-    printf("  pop rax\n");  // スタックから値を取り出して rax に設定
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");  // rbpを戻す
-    printf("  ret\n");
+    // スタックから値を取り出して rax に設定
+    gen_pop("rax");
+    gen_epilogue();
+    return;
+  }
+
+  if (node->kind == ND_SWITCH) {
+    gen_switch(node);
+    return;
+  }
+
+  if (node->kind == ND_CASE) {
+    fprintf(ctx->output, ".Lcase%d:\n", node->label);
+    gen_stmt(node->body);
+    return;
+  }
+
+  if (node->kind == ND_BREAK) {
+    fprintf(ctx->output, "  jmp .Lend%d\n", ctx->break_label);
     return;
   }
 
+  // 計測結果でthen節が半分未満しか実行されていなければ、
+  // 実行される方の節が分岐せずに続くように並べ替える
+  bool then_cold = false;
+  if (node->kind == ND_IF) {
+    int k = ctx->branch_base + node->branch_id;
+    if (ctx->opt_instrument)
+      fprintf(ctx->output, "  inc QWORD PTR [rip + .L.prof.br + %d]\n",
+              16 * k);
+    then_cold = ctx->has_profile && node->count * 2 < node->total;
+    if (ctx->has_profile && node->total == 0) then_cold = true;
+  }
+
   // if (A) B
+  // Bがほとんど実行されないときは、Bを関数の後ろに置く
+  if (node->kind == ND_IF && node->els == NULL && then_cold && !ctx->cold) {
+    int lcold = ctx->label_number++;
+    int lend = ctx->label_number++;
+    gen_comment("IF (A) B（Bは関数の後ろ）");
+    gen_branch(node->cond, true, "cold", lcold);
+    fprintf(ctx->output, ".Lend%d:\n", lend);
+
+    // 出力先が変わるので、それぞれの先頭で.locを出し直す
+    FILE* out = ctx->output;
+    ctx->output = ctx->cold_out;
+    ctx->cold = true;
+    ctx->loc_line = 0;
+    fprintf(ctx->output, ".Lcold%d:\n", lcold);
+    gen_then(node);
+    fprintf(ctx->output, "  jmp .Lend%d\n", lend);
+    ctx->output = out;
+    ctx->cold = false;
+    ctx->loc_line = 0;
+    return;
+  }
+
   if (node->kind == ND_IF && node->els == NULL) {
-    gen(node->cond);
+    int lend = ctx->label_number++;
     gen_comment("IF (A) B");
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je  .Lend%d\n", label_number);
-    gen(node->then);
-    printf(".Lend%d:\n", label_number);
-    label_number++;
+    gen_branch(node->cond, false, "end", lend);
+    gen_then(node);
+    fprintf(ctx->output, ".Lend%d:\n", lend);
     return;
   }
 
   // if (A) B else C
+  // Bの方が実行されないときは、Cを先に置く
+  if (node->kind == ND_IF && node->els != NULL && then_cold) {
+    int lthen = ctx->label_number++;
+    int lend = ctx->label_number++;
+    gen_comment("IF (A) B ELSE C（Cが先）");
+    gen_branch(node->cond, true, "then", lthen);
+    gen_stmt(node->els);
+    fprintf(ctx->output, "  jmp .Lend%d\n", lend);
+    fprintf(ctx->output, ".Lthen%d:\n", lthen);
+    gen_then(node);
+    fprintf(ctx->output, ".Lend%d:\n", lend);
+    return;
+  }
+
   if (node->kind == ND_IF && node->els != NULL) {
-    int lelse = label_number;
-    int lend = label_number + 1;
-    label_number += 2;
-    gen(node->cond);
+    int lelse = ctx->label_number++;
+    int lend = ctx->label_number++;
     gen_comment("IF (A) B ELSE C");
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je  .Lelse%d\n", lelse);
-    gen(node->then);
-    printf("  jmp .Lend%d\n", lend);
-    printf(".Lelse%d:\n", lelse);
-    gen(node->els);
-    printf(".Lend%d:\n", lend);
+    gen_branch(node->cond, false, "else", lelse);
+    gen_then(node);
+    fprintf(ctx->output, "  jmp .Lend%d\n", lend);
+    fprintf(ctx->output, ".Lelse%d:\n", lelse);
+    gen_stmt(node->els);
+    fprintf(ctx->output, ".Lend%d:\n", lend);
     return;
   }
 
+  // ループは条件判定を末尾に置いたdo-while形に変形する。
+  // 入口で一度だけ条件を判定し、1回の繰り返しでは分岐を1つしか通らない
+  //
+  //     条件が偽なら.Lendへ
+  //   .Lbegin:
+  //     本体
+  //     条件が真なら.Lbeginへ
+  //   .Lend:
   if (node->kind == ND_WHILE) {
-    int lbegin = label_number;
-    int lend = label_number + 1;
+    int lbegin = ctx->label_number++;
+    int lend = ctx->label_number++;
     gen_comment("WHILE文");
-    printf(".Lbegin%d:\n", lbegin);
-    gen(node->cond);
-    printf("  pop rax\n");
-    printf("  cmp rax, 0\n");
-    printf("  je .Lend%d\n", lend);
-    gen(node->body);
-    // ループ内で return 文が実行された場合、ループを終了する
-    printf("  jmp .Lbegin%d\n", lbegin);
-    printf(".Lend%d:\n", lend);
-    label_number += 2;
+    gen_branch(node->cond, false, "end", lend);
+    if (!ctx->cold) fprintf(ctx->output, "  .p2align 4\n");
+    fprintf(ctx->output, ".Lbegin%d:\n", lbegin);
+    gen_body(node->body, lend);
+    gen_loc(node->cond);
+    gen_branch(node->cond, true, "begin", lbegin);
+    fprintf(ctx->output, ".Lend%d:\n", lend);
     return;
   }
 
   if (node->kind == ND_FOR) {
-    int lbegin = label_number;
-    int lend = label_number + 1;
-    if (node->init) gen(node->init);
+    int lbegin = ctx->label_number++;
+    int lend = ctx->label_number++;
+    if (node->init) gen_stmt(node->init);
+    if (node->vec) gen_vector_loop(node->vec);
     gen_comment("FOR文");
-    printf(".Lbegin%d:\n", lbegin);
+    if (node->cond) gen_branch(node->cond, false, "end", lend);
+    if (!ctx->cold) fprintf(ctx->output, "  .p2align 4\n");
+    fprintf(ctx->output, ".Lbegin%d:\n", lbegin);
+    gen_body(node->body, lend);
+    if (node->inc) gen_stmt(node->inc);
     if (node->cond) {
-      gen(node->cond);
-      printf("  pop rax\n");
-      printf("  cmp rax, 0\n");
-      printf("  je .Lend%d\n", lend);
+      gen_loc(node->cond);
+      gen_branch(node->cond, true, "begin", lbegin);
+    } else {
+      fprintf(ctx->output, "  jmp .Lbegin%d\n", lbegin);
     }
-    gen(node->body);
-    if (node->inc) gen(node->inc);
-    printf("  jmp .Lbegin%d\n", lbegin);
-    printf(".Lend%d:\n", lend);
-    label_number += 2;
+    fprintf(ctx->output, ".Lend%d:\n", lend);
     return;
   }
 
   if (node->kind == ND_CALL) {
-    char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-
-    // 引数を評価してスタックに積む
-    for (int i = 0; i < node->stmts_len; i++) {
-      gen(node->stmts[i]);
-    }
-
-    // スタックから引数をポップしてレジスタに格納
-    // 最後の引数から順にポップして、最初の引数がrdiに入るようにする
-    for (int i = node->stmts_len - 1; i >= 0; i--) {
-      printf("  pop %s\n", arg_regs[i]);
-    }
-
-    // System V ABIの規約: 可変長引数関数を呼ぶ時は、
-    // ベクトルレジスタで渡される浮動小数点引数の個数をALに入れる
-    // 浮動小数点数がないので常に0
-    printf("  mov al, 0\n");
-    printf("  call _%s\n", node->funcname);
-    printf("  push rax\n");  // 関数の戻り値をスタックにプッシュ
+    if (!gen_mem_builtin(node)) gen_call(node);
     return;
   }
 
   switch (node->kind) {
     case ND_NUM:
-      printf("  push %d\n", node->val);
+      gen_push("%d", node->val);
       return;
     case ND_STR:
       // 文字列リテラルのアドレスをプッシュ
       gen_comment("文字列リテラルのアドレスを取得");
-      printf("  lea rax, [rip + .L.str%d]\n", node->str_label);
-      printf("  push rax\n");
+      fprintf(ctx->output, "  lea rax, [rip + .L.str%d]\n", node->str_label);
+      gen_push("rax");
+      return;
+    case ND_DATA: {
+      // ローカル配列の初期値を.rodataに置き、そのアドレスをプッシュ
+      int data = ctx->label_number++;
+      fprintf(ctx->rodata_out, "  .p2align %d\n",
+              __builtin_ctz(align_of(node->type)));
+      fprintf(ctx->rodata_out, ".L.data%d:\n", data);
+      gen_data(ctx->rodata_out, node->type, node->stmts, node->stmts_len);
+      fprintf(ctx->output, "  lea rax, [rip + .L.data%d]\n", data);
+      gen_push("rax");
       return;
+    }
     case ND_DECL:
       return;
     case ND_LVAR:
+      if (var_reg(node) >= 0) {
+        gen_push(saved_regs[var_reg(node)]);
+        return;
+      }
       gen_lval(node);
-      // 配列型の場合はアドレスをそのまま使う（配列からポインタへの減衰）
-      if (node->type && node->type->ty == ARRAY) {
+      // 配列型の場合はアドレスをそのまま使う（配列からポインタへの減衰）。
+      // 構造体もアドレスで扱う
+      if (is_aggregate(node->type)) {
         // アドレスがスタックに積まれている状態でそのまま返す
         return;
       }
       // 通常の変数の場合は値をロード
       gen_comment("右辺値として変数の値を取得");
-      printf("  pop rax\n");  // raxにアドレスの値が入っているはず
-      if (node->type && node->type->ty == CHAR) {
-        // char型は1バイトとして符号拡張して読み込む
-        printf("  movsx rax, BYTE PTR [rax]\n");
-      } else {
-        // int, ポインタは8バイトとして読み込む
-        printf("  mov rax, [rax]\n");
-      }
-      printf("  push rax\n");  // ロードした値をpush
+      gen_pop("rax");  // raxにアドレスの値が入っているはず
+      gen_load(node->type);
+      gen_push("rax");  // ロードした値をpush
       return;
     case ND_GVAR:
       gen_lval(node);
-      // 配列型の場合はアドレスをそのまま使う（配列からポインタへの減衰）
-      if (node->type && node->type->ty == ARRAY) {
+      // 配列型の場合はアドレスをそのまま使う（配列からポインタへの減衰）。
+      // 構造体もアドレスで扱う
+      if (is_aggregate(node->type)) {
         // アドレスがスタックに積まれている状態でそのまま返す
         return;
       }
       // 通常の変数の場合は値をロード
       gen_comment("右辺値としてグローバル変数の値を取得");
-      printf("  pop rax\n");  // raxにアドレスの値が入っているはず
-      if (node->type && node->type->ty == CHAR) {
-        // char型は1バイトとして符号拡張して読み込む
-        printf("  movsx rax, BYTE PTR [rax]\n");
-      } else {
-        // int, ポインタは8バイトとして読み込む
-        printf("  mov rax, [rax]\n");
-      }
-      printf("  push rax\n");  // ロードした値をpush
+      gen_pop("rax");  // raxにアドレスの値が入っているはず
+      gen_load(node->type);
+      gen_push("rax");  // ロードした値をpush
       return;
     case ND_ASSIGN:
       gen_lval(node->lhs);
       gen_comment("ASSIGN : 左辺値として変数の値を取得");
       gen(node->rhs);
 
+      if (node->type && is_aggregate(node->type)) {
+        // 構造体の代入と配列の初期化はメモリのコピー。
+        // 式の値はコピー先のアドレス
+        gen_pop("rdi");
+        gen_pop("rax");
+        gen_copy(size_of(node->type));
+        gen_push("rax");
+        return;
+      }
+
       // スタックのトップにある右辺値を取り出してrdiに格納
-      printf("  pop rdi\n");
+      gen_pop("rdi");
       // スタックの次の値(左辺値のアドレスを取り出す)
-      printf("  pop rax\n");
-      // 左辺の型に応じて適切なサイズで書き込む
-      if (node->lhs->type && node->lhs->type->ty == CHAR) {
-        // char型は1バイト
-        gen_comment("char型への代入");
-        printf("  mov [rax], dil\n");
-      } else if (node->lhs->kind == ND_DEREF) {
-        // ポインタ経由のアクセス（配列要素など）
-        if (node->lhs->type && node->lhs->type->ty == PTR) {
-          // ポインタ型への代入は8バイト
-          printf("  mov [rax], rdi\n");
-        } else {
-          // int型（配列要素）への代入は4バイト
-          printf("  mov [rax], edi\n");
-        }
-      } else {
-        // スカラー変数（int, ポインタ）は8バイト
-        printf("  mov [rax], rdi\n");
-      }
-      printf("  push rdi\n");
+      gen_pop("rax");
+      // intの値をポインタに代入する場合は64ビットに符号拡張する
+      if (is_wide(node->lhs->type) && !is_wide(node->rhs->type))
+        fprintf(ctx->output, "  movsxd rdi, edi\n");
+      gen_store(node->lhs);
+      gen_push("rdi");
+      return;
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      gen_assign_op(node, true);
       return;
     case ND_ADDR:
       gen_lval(node->lhs);  // nodeのアドレスを取得すれば良い
-      gen_comment("&演算 : &%d", node->lhs->val);
+      gen_comment("&演算");
+      return;
+    case ND_MEMBER:
+      gen_lval(node);
+      if (is_aggregate(node->type)) return;
+      gen_pop("rax");
+      gen_load(node->type);
+      gen_push("rax");
       return;
     case ND_DEREF:
       gen(node->lhs);  // まず値を計算する
       gen_comment("単項*の計算");
-      printf("  pop rax\n");  // スタックのtopにある値を取得
+      gen_pop("rax");  // スタックのtopにある値を取得
       // デリファレンス結果の型に応じてメモリアクセスサイズを決定
-      if (node->type && node->type->ty == PTR) {
-        // ポインタ型の場合は8バイト
-        printf("  mov rax, [rax]\n");
-      } else if (node->type && node->type->ty == CHAR) {
-        // char型の場合は1バイト（符号拡張）
-        printf("  movsx rax, BYTE PTR [rax]\n");
-      } else {
-        // int型（配列要素など）の場合は4バイト
-        printf("  movsxd rax, DWORD PTR [rax]\n");
-      }
-      printf("  push rax\n");
+      gen_load(node->type);
+      gen_push("rax");
+      return;
+    case ND_LOGAND:
+    case ND_LOGOR: {
+      // 値が必要なときだけ、分岐の行き先で0か1を作る
+      int num = ctx->label_number++;
+      gen_branch(node, false, "false", num);
+      gen_push("1");
+      fprintf(ctx->output, "  jmp .Lbool%d\n", num);
+      ctx->depth--;  // .Lfalseには1を積む前の深さで来る
+      fprintf(ctx->output, ".Lfalse%d:\n", num);
+      gen_push("0");
+      fprintf(ctx->output, ".Lbool%d:\n", num);
+      return;
+    }
+    case ND_NOT:
+      gen(node->lhs);
+      gen_pop("rax");
+      fprintf(ctx->output, "  cmp %s, 0\n",
+              is_wide(node->lhs->type) ? "rax" : "eax");
+      fprintf(ctx->output, "  sete al\n");
+      fprintf(ctx->output, "  movzx eax, al\n");
+      gen_push("rax");
       return;
   }
 
   gen(node->lhs);
   gen(node->rhs);
 
-  printf("  pop rdi\n");
-  printf("  pop rax\n");
+  gen_pop("rdi");
+  gen_pop("rax");
 
+  // intの演算は32ビットで行う。ポインタとintの演算では、
+  // intの側を64ビットに符号拡張してから要素サイズを掛ける
   switch (node->kind) {
     case ND_ADD:
-      // ポインタ + 整数の場合、整数側に要素サイズを掛ける
-      // 配列型の場合もポインタとして扱う
-      if (node->lhs->type &&
-          (node->lhs->type->ty == PTR || node->lhs->type->ty == ARRAY)) {
+      if (is_wide(node->lhs->type)) {
         gen_comment("ポインタの足し算");
-        int size = node->lhs->type->ty == PTR
-                       ? size_of(node->lhs->type->ptr_to)
-                       : size_of(node->lhs->type->ptr_to);
-        printf("  imul rdi, %d\n", size);
+        fprintf(ctx->output, "  movsxd rdi, edi\n");
+        fprintf(ctx->output, "  imul rdi, %d\n",
+                size_of(node->lhs->type->ptr_to));
+        fprintf(ctx->output, "  add rax, rdi\n");
+      } else if (is_wide(node->rhs->type)) {
+        gen_comment("ポインタの足し算");
+        fprintf(ctx->output, "  movsxd rax, eax\n");
+        fprintf(ctx->output, "  imul rax, %d\n",
+                size_of(node->rhs->type->ptr_to));
+        fprintf(ctx->output, "  add rax, rdi\n");
+      } else {
+        fprintf(ctx->output, "  add eax, edi\n");
       }
-      printf("  add rax, rdi\n");
       break;
     case ND_SUB:
-      // ポインタ - 整数の場合
-      // 配列型の場合もポインタとして扱う
-      if (node->lhs->type &&
-          (node->lhs->type->ty == PTR || node->lhs->type->ty == ARRAY)) {
+      if (is_wide(node->lhs->type) && is_wide(node->rhs->type)) {
+        // ポインタ同士の差は要素数にする
+        gen_comment("ポインタ同士の引き算");
+        fprintf(ctx->output, "  sub rax, rdi\n");
+        fprintf(ctx->output, "  mov rdi, %d\n",
+                size_of(node->lhs->type->ptr_to));
+        fprintf(ctx->output, "  cqo\n");
+        fprintf(ctx->output, "  idiv rdi\n");
+      } else if (is_wide(node->lhs->type)) {
         gen_comment("ポインタの引き算");
-        int size =
-            size_of(node->lhs->type->ptr_to);  // ポインタが指す型のサイズ
-        printf("  imul rdi, %d\n", size);
+        fprintf(ctx->output, "  movsxd rdi, edi\n");
+        fprintf(ctx->output, "  imul rdi, %d\n",
+                size_of(node->lhs->type->ptr_to));
+        fprintf(ctx->output, "  sub rax, rdi\n");
+      } else {
+        fprintf(ctx->output, "  sub eax, edi\n");
       }
-      printf("  sub rax, rdi\n");
       break;
     case ND_MUL:
-      printf("  imul rax, rdi\n");
+      fprintf(ctx->output, "  imul eax, edi\n");
       break;
     case ND_DIV:
-      // cqo .. raxに入っている64ビットの値を128ビットに引き延ばして
-      // rdxとraxにセットする
-      // idiv rdi ... raxをrdiで割って商をraxに、余りをrdxにセットする
-      printf("  cqo\n");
-      printf("  idiv rdi\n");
+      // cdq .. eaxに入っている32ビットの値を64ビットに引き延ばして
+      // edxとeaxにセットする
+      // idiv edi ... eaxをediで割って商をeaxに、余りをedxにセットする
+      fprintf(ctx->output, "  cdq\n");
+      fprintf(ctx->output, "  idiv edi\n");
       break;
     case ND_EQ:  // ==
-      printf("  cmp rax, rdi\n");
+      gen_cmp(node);
       // sete... cmpで比較したレジスタが同じなら1,
       // 違ったら0をALレジスタにセットする AL ..
       // raxの下位8ビットを指すレジスタ
-      // rax全部を0か1にセットするので、上位56ビットをmovzx命令でゼロクリアする
-      printf("  sete al\n");
-      printf("  movzx rax, al\n");
+      // eax全部を0か1にセットするので、上位24ビットをmovzx命令でゼロクリアする
+      fprintf(ctx->output, "  sete al\n");
+      fprintf(ctx->output, "  movzx eax, al\n");
       break;
     case ND_NE:  // !=
-      printf("  cmp rax, rdi\n");
-      printf("  setne al\n");
-      printf("  movzx rax, al\n");
+      gen_cmp(node);
+      fprintf(ctx->output, "  setne al\n");
+      fprintf(ctx->output, "  movzx eax, al\n");
       break;
     case ND_LE:  // <=
-      printf("  cmp rax, rdi\n");
-      printf("  setle al\n");
-      printf("  movzx rax, al\n");
+      gen_cmp(node);
+      fprintf(ctx->output, "  setle al\n");
+      fprintf(ctx->output, "  movzx eax, al\n");
       break;
     case ND_LT:  // <
-      printf("  cmp rax, rdi\n");
-      printf("  setl al\n");
-      printf("  movzx rax, al\n");
+      gen_cmp(node);
+      fprintf(ctx->output, "  setl al\n");
+      fprintf(ctx->output, "  movzx eax, al\n");
       break;
     default:
       error("未対応のノード種類です: %d", node->kind);
   }
 
-  printf("  push rax\n");
-}
\ No newline at end of file
+  gen_push("rax");
+}
+// .bssに0で初期化された計測表を置く
+void gen_prof_table(char* label, int size) {
+#ifdef __APPLE__
+  fprintf(ctx->output, ".zerofill __DATA,__bss,%s,%d,3\n", label, size);
+#else
+  fprintf(ctx->output, "  .p2align 3\n");
+  fprintf(ctx->output, "%s:\n", label);
+  fprintf(ctx->output, "  .zero %d\n", size);
+#endif
+}
+
+// -finstrumentの計測結果を標準エラー出力に書き出す関数を出力する。
+// 1行に1関数ずつ「関数名 呼び出し回数 サイクル数」を、続いて1行に
+// 1つのifずつ「関数名@番号 評価した回数 真だった回数」をタブ区切りで書く。
+// -fprofile-useはこの形式を読む
+void gen_prof_dump(Node** funcs, int nfuncs) {
+  fprintf(ctx->output, "\n.L.prof_dump:\n");
+  fprintf(ctx->output, "  push rbp\n");
+  fprintf(ctx->output, "  mov rbp, rsp\n");
+  for (int k = 0; k < nfuncs; k++) {
+    fprintf(ctx->output, "  mov edi, 2\n");
+    fprintf(ctx->output, "  lea rsi, [rip + .L.prof_fmt]\n");
+    fprintf(ctx->output, "  lea rdx, [rip + .L.prof_name%d]\n", k);
+    fprintf(ctx->output, "  mov rcx, [rip + .L.prof + %d]\n", 16 * k);
+    fprintf(ctx->output, "  mov r8, [rip + .L.prof + %d]\n", 16 * k + 8);
+    fprintf(ctx->output, "  mov eax, 0\n");
+    fprintf(ctx->output, "  call " SYM_PREFIX "dprintf\n");
+  }
+  int j = 0;
+  for (int k = 0; k < nfuncs; k++) {
+    for (int id = 0; id < funcs[k]->branch_id; id++, j++) {
+      fprintf(ctx->output, "  mov edi, 2\n");
+      fprintf(ctx->output, "  lea rsi, [rip + .L.prof_brfmt]\n");
+      fprintf(ctx->output, "  lea rdx, [rip + .L.prof_name%d]\n", k);
+      fprintf(ctx->output, "  mov ecx, %d\n", id);
+      fprintf(ctx->output, "  mov r8, [rip + .L.prof.br + %d]\n", 16 * j);
+      fprintf(ctx->output, "  mov r9, [rip + .L.prof.br + %d]\n", 16 * j + 8);
+      fprintf(ctx->output, "  mov eax, 0\n");
+      fprintf(ctx->output, "  call " SYM_PREFIX "dprintf\n");
+    }
+  }
+  fprintf(ctx->output, "  pop rbp\n");
+  fprintf(ctx->output, "  ret\n");
+
+#ifdef __APPLE__
+  fprintf(ctx->output, "\n.cstring\n");
+#else
+  fprintf(ctx->output, "\n.section .rodata.str1.1,\"aMS\",@progbits,1\n");
+#endif
+  fprintf(ctx->output, ".L.prof_fmt:\n");
+  fprintf(ctx->output, "  .string \"%%s\\t%%ld\\t%%ld\\n\"\n");
+  fprintf(ctx->output, ".L.prof_brfmt:\n");
+  fprintf(ctx->output, "  .string \"%%s@%%d\\t%%ld\\t%%ld\\n\"\n");
+  for (int k = 0; k < nfuncs; k++) {
+    fprintf(ctx->output, ".L.prof_name%d:\n", k);
+    fprintf(ctx->output, "  .string \"%s\"\n", funcs[k]->funcname);
+  }
+}
+
+// アセンブリの最初の部分を出力する。関数はこの後ろに続ける
+void gen_begin() {
+  fprintf(ctx->output, ".intel_syntax noprefix\n");
+  fprintf(ctx->output, ".file 1 \"%s\"\n", ctx->filename);
+  fprintf(ctx->output, ".globl " SYM_PREFIX "main\n");
+  fprintf(ctx->output, "\n.text\n");
+  ctx->rodata_out = open_memstream(&ctx->rodata_buf, &ctx->rodata_len);
+}
+
+// 関数定義を1つ最適化して出力する。indexは定義順の番号（計測表の添え字）、
+// branch_baseはその関数の最初のifの、分岐の計測表の添え字。
+// 最適化とコード生成で作るものは、関数の構文木と同じアリーナに置く
+void gen_function(Node* func, int index, int branch_base) {
+  ctx->func_index = index;
+  ctx->branch_base = branch_base;
+  ctx->use_arena = true;
+  optimize(func);
+  gen(func);
+  ctx->use_arena = false;
+}
+
+// 文字列リテラルが途中に'\0'を含むかどうか
+bool has_nul(Str_vec* str) {
+  char* p = str->str;
+  while (p < str->str + str->len)
+    if (read_char(&p) == 0) return true;
+  return false;
+}
+
+// 文字列リテラルをラベルとともにfpに出力する
+void gen_string(FILE* fp, Str_vec* str) {
+  fprintf(fp, ".L.str%d:\n", str->label);
+  fprintf(fp, "  .string \"");
+  for (int i = 0; i < str->len; i++) fprintf(fp, "%c", str->str[i]);
+  fprintf(fp, "\"\n");
+}
+
+// 関数の後ろに置くものを出力する。文字列リテラルとグローバル変数は
+// すべての関数を読み終えるまで揃わないので、最後にまとめて置く
+void gen_end() {
+  Node** funcs = ctx->funcs ? ctx->funcs->data : NULL;
+  int nfuncs = ctx->funcs ? ctx->funcs->len : 0;
+  if (ctx->opt_instrument && nfuncs) gen_prof_dump(funcs, nfuncs);
+
+  // 文字列リテラルを出力
+  // 読み取り専用で、リンカが同じ内容の文字列をまとめられるセクションに置く
+#ifdef __APPLE__
+  fprintf(ctx->output, "\n.cstring\n");
+#else
+  fprintf(ctx->output, "\n.section .rodata.str1.1,\"aMS\",@progbits,1\n");
+#endif
+  // 途中に'\0'を含む文字列はまとめたり分けたりされると中身が変わるので、
+  // 後で出力する.rodataに置く
+  for (Str_vec* str = ctx->strings; str; str = str->next)
+    gen_string(has_nul(str) ? ctx->rodata_out : ctx->output, str);
+
+  // 初期値を持つグローバル変数は.dataに置く
+#ifdef __APPLE__
+  fprintf(ctx->output, "\n.section __DATA,__data\n");
+#else
+  fprintf(ctx->output, "\n.data\n");
+#endif
+  for (GVar* gvar = ctx->globals; gvar; gvar = gvar->next) {
+    if (!gvar->init) continue;
+    fprintf(ctx->output, "  .p2align %d\n",
+            __builtin_ctz(align_of(gvar->type)));
+#ifndef __APPLE__
+    fprintf(ctx->output, GVAR_PREFIX "%s:\n", gvar->name);
+#endif
+    fprintf(ctx->output, SYM_PREFIX "%s:\n", gvar->name);
+    gen_data(ctx->output, gvar->type, gvar->init, gvar->init_len);
+  }
+
+  // 残りのグローバル変数の初期値はすべて0なので、
+  // ファイル上に領域を持たない.bssに置く
+#ifndef __APPLE__
+  fprintf(ctx->output, "\n.bss\n");
+#endif
+  for (GVar* gvar = ctx->globals; gvar; gvar = gvar->next) {
+    if (gvar->init) continue;
+    int align = align_of(gvar->type);
+#ifdef __APPLE__
+    fprintf(ctx->output, ".zerofill __DATA,__bss,_%s,%d,%d\n", gvar->name,
+            size_of(gvar->type), __builtin_ctz(align));
+#else
+    fprintf(ctx->output, "  .p2align %d\n", __builtin_ctz(align));
+    fprintf(ctx->output, GVAR_PREFIX "%s:\n", gvar->name);
+    fprintf(ctx->output, "%s:\n", gvar->name);
+    fprintf(ctx->output, "  .zero %d\n", size_of(gvar->type));
+#endif
+  }
+
+  // -finstrumentの計測表。関数ごとに呼び出し回数とサイクル数を、
+  // ifごとに条件を評価した回数と真だった回数を持つ
+  int nbranches = 0;
+  for (int i = 0; i < nfuncs; i++) nbranches += funcs[i]->branch_id;
+  if (ctx->opt_instrument && nfuncs) {
+    gen_prof_table(".L.prof", 16 * nfuncs);
+    if (nbranches) gen_prof_table(".L.prof.br", 16 * nbranches);
+  }
+
+  // ジャンプテーブル、配列の初期値、'\0'を含む文字列を
+  // 読み取り専用のセクションに置く
+  fclose(ctx->rodata_out);
+  if (ctx->rodata_len) {
+#ifdef __APPLE__
+    fprintf(ctx->output, "\n.section __TEXT,__const\n");
+#else
+    fprintf(ctx->output, "\n.section .rodata\n");
+#endif
+    fputs(ctx->rodata_buf, ctx->output);
+  }
+  free(ctx->rodata_buf);
+
+#ifndef __APPLE__
+  // スタックを実行可能にする必要がないことをリンカに伝える
+  fprintf(ctx->output, "\n.section .note.GNU-stack,\"\",@progbits\n");
+#endif
+}
+
+// 解析し終えたプログラム全体のアセンブリを出力する
+void gen_program() {
+  gen_begin();
+
+  // 関数定義は定義順に並んでいる。計測表の添え字はこの順番
+  Node** funcs = ctx->funcs ? ctx->funcs->data : NULL;
+  int nfuncs = ctx->funcs ? ctx->funcs->len : 0;
+  int* branch_base = calloc(nfuncs + 1, sizeof(int));
+  for (int i = 0; i < nfuncs; i++)
+    branch_base[i + 1] = branch_base[i] + funcs[i]->branch_id;
+
+  // 計測結果があれば、よく呼ばれる関数から順に並べて、
+  // 一度も呼ばれていない関数は別のセクションに分ける
+  int* order = calloc(nfuncs, sizeof(int));
+  for (int i = 0; i < nfuncs; i++) order[i] = i;
+  for (int i = 1; ctx->has_profile && i < nfuncs; i++) {
+    int t = order[i];
+    int j = i;
+    for (; j > 0 && funcs[order[j - 1]]->count < funcs[t]->count; j--)
+      order[j] = order[j - 1];
+    order[j] = t;
+  }
+
+  // 関数定義を出力
+  for (int i = 0; i < nfuncs; i++) {
+    Node* func = funcs[order[i]];
+#ifndef __APPLE__
+    if (ctx->has_profile && func->count == 0 &&
+        (i == 0 || funcs[order[i - 1]]->count))
+      fprintf(ctx->output, "\n.section .text.unlikely,\"ax\",@progbits\n");
+#endif
+    gen_function(func, order[i], branch_base[order[i]]);
+  }
+  free(order);
+  free(branch_base);
+
+  gen_end();
+}
@@ -0,0 +1,82 @@
+#include "9cc.h"
+
+// コンパイル中のコンテキスト。スレッドごとに別々のものを指す
+_Thread_local CompilerContext* ctx;
+
+CompilerContext* new_context(char* filename) {
+  CompilerContext* c = calloc(1, sizeof(CompilerContext));
+  c->filename = filename;
+  return c;
+}
+
+// 関数を1つ解析するたびにそのコードを出力し、構文木とローカル変数を
+// 解放する。使うメモリは入力全体ではなく最大の関数の大きさで決まる
+void compile_functions() {
+  gen_begin();
+  int nbranches = 0;
+  while (!at_eof()) {
+    Node* node = top_level();
+    if (node->kind != ND_FUNC) continue;
+    gen_function(node, ctx->funcs->len - 1, nbranches);
+    nbranches += node->branch_id;
+
+    // 関数のノードは、呼び出しの戻り値の型と計測結果の出力に使うので残す
+    arena_reset();
+    node->params = NULL;
+    node->params_len = 0;
+    node->body = NULL;
+    ctx->locals = NULL;
+  }
+  gen_end();
+}
+
+// srcをコンパイルして、アセンブリをfpに書き出す。
+// エラーのときはfalseを返し、c->errorにメッセージを入れる
+bool compile_to(CompilerContext* c, char* src, FILE* fp) {
+  CompilerContext* saved = ctx;
+  jmp_buf env;
+
+  ctx = c;
+  c->user_input = src;
+  c->output = fp;
+  c->on_error = &env;
+  if (setjmp(env)) {
+    arena_reset();
+    c->on_error = NULL;
+    ctx = saved;
+    return false;
+  }
+
+  c->operands = new_vector();
+  tokenize(src);
+  c->pos = 0;
+  c->locals = calloc(1, sizeof(LVar));
+  if (c->profile_path) {
+    // 計測結果に従って関数を並べ替えるので、全体を解析してから出力する
+    program();
+    read_profile(c->profile_path);
+    gen_program();
+  } else {
+    compile_functions();
+  }
+  arena_reset();
+
+  c->on_error = NULL;
+  ctx = saved;
+  return true;
+}
+
+// srcをコンパイルして、アセンブリのテキストを返す。
+// エラーのときはNULLを返し、c->errorにメッセージを入れる
+char* compile(CompilerContext* c, char* src) {
+  char* text = NULL;
+  size_t len = 0;
+  FILE* fp = open_memstream(&text, &len);
+  bool ok = compile_to(c, src, fp);
+  fclose(fp);
+  if (!ok) {
+    free(text);
+    return NULL;
+  }
+  return text;
+}
@@ -1,60 +1,98 @@
+#include <errno.h>
+
 #include "9cc.h"
 
+// foo.cからfoo.oのように、拡張子を.oに置き換えたファイル名を作る
+char* object_path(char* path) {
+  char* base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  char* dot = strrchr(base, '.');
+  int len = dot ? dot - base : strlen(base);
+  char* buf = calloc(1, len + 3);
+  sprintf(buf, "%.*s.o", len, base);
+  return buf;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2) {
+  char* path = NULL;
+  char* out_path = NULL;
+  bool opt_avx2 = false;  // -mavx2: AVX2命令でベクトル化する
+  bool opt_instrument = false;  // -finstrument: 計測用のコードを埋め込む
+  char* profile_path = NULL;    // -fprofile-use=file: 計測結果を使う
+  bool opt_c = false;  // -c: アセンブリではなくオブジェクトファイルを出力する
+  bool opt_run = false;  // --run: 機械語をメモリ上に置いてその場で実行する
+  // --runで読み込む共有ライブラリ
+  char** libs = calloc(argc, sizeof(char*));
+  int nlibs = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-mavx2")) {
+      opt_avx2 = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "-finstrument")) {
+      opt_instrument = true;
+      continue;
+    }
+    if (!strncmp(argv[i], "-fprofile-use=", 14)) {
+      profile_path = argv[i] + 14;
+      continue;
+    }
+    if (!strcmp(argv[i], "-c")) {
+      opt_c = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "--run")) {
+      opt_run = true;
+      continue;
+    }
+    if (!strcmp(argv[i], "-o")) {
+      if (++i == argc) error("-oの後にファイル名がありません");
+      out_path = argv[i];
+      continue;
+    }
+    int len = strlen(argv[i]);
+    if (len > 3 && !strcmp(argv[i] + len - 3, ".so")) {
+      libs[nlibs++] = argv[i];
+      continue;
+    }
+    if (argv[i][0] == '-' || path) error("引数が正しくありません: %s", argv[i]);
+    path = argv[i];
+  }
+  if (!path) {
     error("引数の個数が正しくありません");
     return 1;
   }
-  // トークナイズする
-  user_input = read_file(argv[1]);
-  token = tokenize(user_input);
-  locals = calloc(1, sizeof(LVar));
-  program();
-
-  // アセンブリの前半部分を出力
-  printf(".intel_syntax noprefix\n");
-  printf(".globl _main\n");
-
-  // 文字列リテラルを出力
-  printf("\n.data\n");
-  for (Str_vec* str = strings; str; str = str->next) {
-    printf(".L.str%d:\n", str->label);
-    printf("  .string \"");
-    for (int i = 0; i < str->len; i++) {
-      char c = str->str[i];
-      printf("%c", c);
-    }
-    printf("\"\n");
-  }
 
-  // グローバル変数の宣言を出力
-  for (GVar* gvar = globals; gvar; gvar = gvar->next) {
-    printf("_%s:\n", gvar->name);
-    if (gvar->type->ty == ARRAY) {
-      // 配列の場合：サイズ分のゼロを確保
-      printf("  .zero %zu\n",
-             gvar->type->array_size * size_of(gvar->type->ptr_to));
-    } else if (gvar->type->ty == CHAR) {
-      // char型：1バイト確保
-      printf("  .byte 0\n");
-    } else {
-      // int型、ポインタ型：8バイト確保(値は0に初期化)
-      printf("  .quad 0\n");
+  CompilerContext* c = new_context(path);
+  c->opt_avx2 = opt_avx2;
+  c->opt_instrument = opt_instrument;
+  c->profile_path = profile_path;
+  char* src = read_file(path);
+
+  // アセンブリを出力するときは、関数ごとにそのまま書き出す
+  if (!opt_run && !opt_c) {
+    FILE* fp = out_path ? fopen(out_path, "w") : stdout;
+    if (!fp) error("cannot open %s: %s", out_path, strerror(errno));
+    bool ok = compile_to(c, src, fp);
+    if (out_path) fclose(fp);
+    if (!ok) {
+      if (out_path) remove(out_path);
+      fputs(c->error, stderr);
+      return 1;
     }
+    return 0;
   }
-  printf("\n.text\n");
 
-  // 関数定義を出力
-  for (int i = 0; code[i]; i++) {
-    if (code[i]->kind == ND_FUNC) {
-      gen(code[i]);
-    }
+  char* asm_text = compile(c, src);
+  if (!asm_text) {
+    fputs(c->error, stderr);
+    return 1;
   }
 
-  // エピローグ
-  printf("  mov rsp, rbp\n");
-  printf("  pop rbp\n");
-  printf("  ret\n");
+  if (opt_run)
+    exit(run_jit(asm_text, libs, nlibs));
+  else
+    assemble(asm_text, out_path ? out_path : object_path(path));
 
   return 0;
 }
\ No newline at end of file
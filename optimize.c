@@ -0,0 +1,1055 @@
+#include "9cc.h"
+
+// 最適化中の関数。以下の作業用の変数はスレッドごとに持ち、
+// 複数のスレッドで同時にコンパイルできるようにする
+_Thread_local Node* cur_func;
+
+// アドレスを取られているローカル変数のオフセット
+_Thread_local int* addr_taken;
+_Thread_local int addr_taken_len;
+_Thread_local int addr_taken_cap;
+
+// 関数のフレームに一時変数用の領域を確保し、その変数のノードを返す
+Node* new_temp(Type* type) {
+  if (!type) type = new_type(INT, NULL);
+  cur_func->stack_size = align_to(cur_func->stack_size, 8) + 8;
+  Node* node = new_node(ND_LVAR);
+  node->offset = cur_func->stack_size;
+  node->type = type;
+  return node;
+}
+
+// ローカル変数のアドレスが取られているかどうか
+// 構造体のメンバを取り除いた、左辺値の元になる変数かポインタの参照
+Node* lval_base(Node* node) {
+  while (node->kind == ND_MEMBER) node = node->lhs;
+  return node;
+}
+
+bool is_addr_taken(int offset) {
+  for (int i = 0; i < addr_taken_len; i++)
+    if (addr_taken[i] == offset) return true;
+  return false;
+}
+
+// &x の形で使われているローカル変数を集める
+void find_addr_taken(Node* node) {
+  if (!node) return;
+  // &s.xはsのアドレスを取る
+  Node* var = node->kind == ND_ADDR ? lval_base(node->lhs) : NULL;
+  if (var && var->kind == ND_LVAR && !is_addr_taken(var->offset)) {
+    if (addr_taken_len == addr_taken_cap) {
+      addr_taken_cap = addr_taken_cap ? addr_taken_cap * 2 : 8;
+      addr_taken = realloc(addr_taken, addr_taken_cap * sizeof(int));
+    }
+    addr_taken[addr_taken_len++] = var->offset;
+  }
+  find_addr_taken(node->lhs);
+  find_addr_taken(node->rhs);
+  if (is_compact(node->kind)) return;
+  find_addr_taken(node->cond);
+  find_addr_taken(node->then);
+  find_addr_taken(node->els);
+  find_addr_taken(node->init);
+  find_addr_taken(node->inc);
+  find_addr_taken(node->body);
+  for (int i = 0; i < node->stmts_len; i++) find_addr_taken(node->stmts[i]);
+}
+
+// アドレスを取られていないintとポインタの引数は、関数全体を通して
+// callee-savedレジスタ（rbx, r12〜r15）に置き、読み書きでメモリを触らない
+void assign_param_regs(Node* func) {
+  int n = 0;
+  for (int i = 0; i < func->params_len; i++) {
+    Node* param = func->params[i];
+    param->reg = 0;
+    if (n == 5 || is_addr_taken(param->offset)) continue;
+    if (param->type->ty == INT || param->type->ty == PTR) param->reg = ++n;
+  }
+}
+
+//
+// 基本ブロック内の値番号付けによる共通部分式の削除
+//
+// 基本ブロック内の式を評価順にたどり、同じ演算を同じ値番号のオペランドに
+// 適用した式に同じ値番号を付ける。ストアや関数呼び出しがあれば、
+// 書き換えられた可能性のあるロードを表から消すので、それ以降の式には
+// 新しい値番号が付く。2回以上現れた値番号のうち一番外側の式について、
+// 最初の出現を一時変数への代入に、残りの出現を一時変数の読み出しに置き換える。
+//
+
+// 値番号の表の要素。演算と値番号から引くハッシュ表に入れる
+typedef struct VNEntry VNEntry;
+struct VNEntry {
+  VNEntry* next;       // 同じバケットの次の要素
+  VNEntry* prev_made;  // ひとつ前に登録した要素（forget_vnでたどる）
+  VNEntry* next_load;  // 次のロードの要素（kill_loadsでたどる）
+  NodeKind kind;
+  int lhs;     // 左オペランドの値番号
+  int rhs;     // 右オペランドの値番号
+  int val;     // ND_NUMの値 / ND_LVARのオフセット / ND_STRのラベル
+  char* name;  // ND_GVARの変数名
+  int ty;      // 式の型の種類（型がなければ-1）
+  int vn;      // 値番号
+  bool dead;   // 表から取り除かれた
+};
+
+// 式の出現箇所（評価順に並ぶ）
+typedef struct {
+  Node** slot;    // 式を指している親のポインタ
+  int vn;         // 値番号
+  int start;      // 部分木の最初の出現の番号
+  int next_same;  // 同じ値番号の次の出現の番号（なければ-1）
+  bool eligible;  // 一時変数で置き換えられる式か
+  bool dead;      // 外側の式が再利用されるため評価されない
+  bool define;    // 最初の出現（一時変数に代入する）
+  bool reuse;     // 2回目以降の出現（一時変数を読む）
+} Occur;
+
+// 基本ブロックがこれより多くの式を含むときは、途中で区切って置き換える
+#define CSE_MAX_OCCURS 4096
+
+#define VN_BUCKETS 1024
+
+_Thread_local VNEntry* vn_buckets[VN_BUCKETS];
+_Thread_local VNEntry* vn_made;   // 最後に登録した要素
+_Thread_local VNEntry* vn_loads;  // 書き換えで無効になりうるロードの要素
+_Thread_local int vn_base;        // これより小さい値番号の要素は無効
+_Thread_local int vn_next;
+_Thread_local Occur* occurs;
+_Thread_local int occurs_len;
+_Thread_local int occurs_cap;
+
+// 基本ブロックの値番号ごとの出現回数と最後の出現の番号。
+// block_baseからの差で引く
+_Thread_local int block_base;
+_Thread_local int* vn_uses;
+_Thread_local int* vn_last;
+_Thread_local int vn_cap;
+
+int type_key(Node* node) { return node->type ? node->type->ty : -1; }
+
+// 表を空にする。残った要素はlookup_vnで見つけたときにつなぎ替える
+void clear_vn() {
+  vn_base = vn_next;
+  vn_made = NULL;
+  vn_loads = NULL;
+}
+
+unsigned hash_vn(NodeKind kind, int lhs, int rhs, int val, char* name,
+                 int ty) {
+  unsigned h = kind;
+  h = h * 31 + lhs;
+  h = h * 31 + rhs;
+  h = h * 31 + val;
+  h = h * 31 + ty;
+  if (name)
+    for (char* p = name; *p; p++) h = h * 31 + *p;
+  return h % VN_BUCKETS;
+}
+
+// 表から同じ式を探し、なければ新しい値番号で登録する
+int lookup_vn(NodeKind kind, int lhs, int rhs, int val, char* name,
+              int ty) {
+  VNEntry** bucket = &vn_buckets[hash_vn(kind, lhs, rhs, val, name, ty)];
+  for (VNEntry** p = bucket; *p;) {
+    VNEntry* e = *p;
+    if (e->dead || e->vn < vn_base) {
+      *p = e->next;
+      continue;
+    }
+    if (e->kind == kind && e->lhs == lhs && e->rhs == rhs && e->val == val &&
+        e->ty == ty && (!name || (e->name && !strcmp(e->name, name))))
+      return e->vn;
+    p = &e->next;
+  }
+
+  VNEntry* e = arena_alloc(sizeof(VNEntry));
+  e->kind = kind;
+  e->lhs = lhs;
+  e->rhs = rhs;
+  e->val = val;
+  e->name = name;
+  e->ty = ty;
+  e->vn = vn_next++;
+  e->next = *bucket;
+  *bucket = e;
+  e->prev_made = vn_made;
+  vn_made = e;
+  if (((kind == ND_LVAR || kind == ND_GVAR) && ty != ARRAY) ||
+      kind == ND_DEREF) {
+    e->next_load = vn_loads;
+    vn_loads = e;
+  }
+  return e->vn;
+}
+
+// エイリアスの可能性のあるロードを表から取り除く
+// lvar_offset/gvar_nameを指定すると、その変数の読み出しも取り除く
+void kill_loads(bool memory, int lvar_offset, char* gvar_name) {
+  VNEntry** p = &vn_loads;
+  while (*p) {
+    VNEntry* e = *p;
+    bool kill = e->dead;
+    if (e->kind == ND_LVAR)
+      kill |= e->val == lvar_offset || (memory && is_addr_taken(e->val));
+    else if (e->kind == ND_GVAR)
+      kill |= memory || (gvar_name && !strcmp(e->name, gvar_name));
+    else
+      kill |= memory;
+
+    if (kill) {
+      e->dead = true;
+      *p = e->next_load;
+    } else {
+      p = &e->next_load;
+    }
+  }
+}
+
+// 代入の左辺に応じて、書き換えられた可能性のあるロードを取り除く
+void kill_store(Node* lhs) {
+  // メンバへのストアは構造体全体へのストアとみなす
+  lhs = lval_base(lhs);
+  if (lhs->kind == ND_LVAR) {
+    // アドレスを取られていなければ、ポインタ経由で読まれることはない
+    kill_loads(is_addr_taken(lhs->offset), lhs->offset, NULL);
+    return;
+  }
+  if (lhs->kind == ND_GVAR) {
+    kill_loads(true, 0, lhs->funcname);
+    return;
+  }
+  // ポインタ経由のストアは、すべてのメモリを書き換えうる
+  kill_loads(true, 0, NULL);
+}
+
+// 値番号mark以降に登録された式を表から取り除く
+void forget_vn(int mark) {
+  while (vn_made && vn_made->vn >= mark) {
+    vn_made->dead = true;
+    vn_made = vn_made->prev_made;
+  }
+}
+
+int vn_expr(Node** slot);
+
+// 左辺値として評価される式をたどる（アドレスの計算だけが評価される）
+void vn_lval(Node* node) {
+  node = lval_base(node);
+  if (node->kind == ND_DEREF) vn_expr(&node->lhs);
+}
+
+// 式を評価順にたどって値番号を付け、出現箇所を記録する
+int vn_expr(Node** slot) {
+  Node* node = *slot;
+  int start = occurs_len;
+  bool eligible = false;
+  int vn;
+
+  switch (node->kind) {
+    case ND_NUM:
+      vn = lookup_vn(ND_NUM, 0, 0, node->val, NULL, -1);
+      break;
+    case ND_STR:
+      vn = lookup_vn(ND_STR, 0, 0, node->str_label, NULL, -1);
+      break;
+    case ND_LVAR:
+      vn = lookup_vn(ND_LVAR, 0, 0, node->offset, NULL, type_key(node));
+      break;
+    case ND_GVAR:
+      vn = lookup_vn(ND_GVAR, 0, 0, 0, node->funcname, type_key(node));
+      break;
+    case ND_ADDR:
+      if (node->lhs->kind == ND_LVAR) {
+        vn = lookup_vn(ND_ADDR, 0, 0, node->lhs->offset, NULL, -1);
+      } else if (node->lhs->kind == ND_GVAR) {
+        vn = lookup_vn(ND_ADDR, 0, 0, 0, node->lhs->funcname, -1);
+      } else {
+        vn_lval(node->lhs);
+        vn = vn_next++;
+      }
+      break;
+    case ND_DEREF: {
+      int lhs = vn_expr(&node->lhs);
+      vn = lookup_vn(ND_DEREF, lhs, 0, 0, NULL, type_key(node));
+      eligible = type_key(node) != ARRAY && type_key(node) != STRUCT;
+      break;
+    }
+    case ND_MEMBER:
+      // メンバの読み出しは再利用しない
+      vn_lval(node->lhs);
+      vn = vn_next++;
+      break;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT: {
+      int lhs = vn_expr(&node->lhs);
+      int rhs = vn_expr(&node->rhs);
+      vn = lookup_vn(node->kind, lhs, rhs, 0, NULL, type_key(node));
+      eligible = type_key(node) != ARRAY;
+      break;
+    }
+    case ND_LOGAND:
+    case ND_LOGOR: {
+      // 右辺は評価されないことがあるので、
+      // 右辺で初めて現れた式は後で再利用できない
+      int lhs = vn_expr(&node->lhs);
+      int mark = vn_next;
+      int rhs = vn_expr(&node->rhs);
+      forget_vn(mark);
+      vn = lookup_vn(node->kind, lhs, rhs, 0, NULL, type_key(node));
+      break;
+    }
+    case ND_NOT: {
+      int lhs = vn_expr(&node->lhs);
+      vn = lookup_vn(ND_NOT, lhs, 0, 0, NULL, type_key(node));
+      eligible = true;
+      break;
+    }
+    case ND_ASSIGN:
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      vn_lval(node->lhs);
+      vn_expr(&node->rhs);
+      kill_store(node->lhs);
+      vn = vn_next++;
+      break;
+    case ND_CALL: {
+      // gen_callと同じ順にたどる。スタックに積む引数を後ろから、
+      // 次に計算の必要なレジスタ引数、最後に単純な引数
+      int nregs = node->stmts_len < 6 ? node->stmts_len : 6;
+      for (int i = node->stmts_len - 1; i >= 6; i--) vn_expr(&node->stmts[i]);
+      for (int i = 0; i < nregs; i++)
+        if (!is_simple_arg(node->stmts[i])) vn_expr(&node->stmts[i]);
+      for (int i = 0; i < nregs; i++)
+        if (is_simple_arg(node->stmts[i])) vn_expr(&node->stmts[i]);
+      // 呼び出し先はグローバル変数やポインタの先を書き換えうる
+      kill_loads(true, 0, NULL);
+      vn = vn_next++;
+      break;
+    }
+    case ND_DATA:
+      // 初期値は毎回同じ場所からコピーするが、式としてはまとめない
+      vn = vn_next++;
+      break;
+    default:
+      // 知らない式は何をするか分からないので、表を空にする
+      clear_vn();
+      vn = vn_next++;
+      break;
+  }
+
+  if (occurs_len == occurs_cap) {
+    occurs_cap = occurs_cap ? occurs_cap * 2 : 64;
+    occurs = realloc(occurs, occurs_cap * sizeof(Occur));
+  }
+  Occur* occ = &occurs[occurs_len++];
+  *occ = (Occur){0};
+  occ->slot = slot;
+  occ->vn = vn;
+  occ->start = start;
+  occ->eligible = eligible;
+
+  // 同じ値番号の出現をつなぎ、数を数えておく
+  occ->next_same = -1;
+  int idx = vn - block_base;
+  if (idx >= vn_cap) {
+    int cap = vn_cap;
+    vn_cap = vn_cap ? vn_cap * 2 : 256;
+    while (idx >= vn_cap) vn_cap *= 2;
+    vn_uses = realloc(vn_uses, vn_cap * sizeof(int));
+    vn_last = realloc(vn_last, vn_cap * sizeof(int));
+    memset(vn_uses + cap, 0, (vn_cap - cap) * sizeof(int));
+  }
+  if (vn_uses[idx]++) occurs[vn_last[idx]].next_same = occurs_len - 1;
+  vn_last[idx] = occurs_len - 1;
+  return vn;
+}
+
+// 部分木の大きい出現から順に並べる（同じ大きさなら評価順）
+int cmp_occur_size(const void* a, const void* b) {
+  int x = *(int*)a;
+  int y = *(int*)b;
+  int size_x = x - occurs[x].start;
+  int size_y = y - occurs[y].start;
+  if (size_x != size_y) return size_y - size_x;
+  return x - y;
+}
+
+// 基本ブロックの終わり。共通部分式を一時変数で置き換えて表をリセットする
+void cse_flush() {
+  int* order = calloc(occurs_len + 1, sizeof(int));
+  for (int i = 0; i < occurs_len; i++) order[i] = i;
+  qsort(order, occurs_len, sizeof(int), cmp_occur_size);
+
+  // 外側の式から順に、再利用する出現を決める。
+  // 再利用される出現の内側は評価されなくなるので数えない
+  for (int k = 0; k < occurs_len; k++) {
+    Occur* occ = &occurs[order[k]];
+    if (!occ->eligible || occ->dead || occ->define || occ->reuse) continue;
+
+    if (vn_uses[occ->vn - block_base] < 2) continue;
+    int count = 0;
+    for (int i = order[k]; i >= 0; i = occurs[i].next_same)
+      if (!occurs[i].dead) count++;
+    if (count < 2) continue;
+
+    occ->define = true;
+    for (int i = occ->next_same; i >= 0; i = occurs[i].next_same) {
+      if (occurs[i].dead) continue;
+      occurs[i].reuse = true;
+      for (int j = occurs[i].start; j < i; j++) occurs[j].dead = true;
+    }
+  }
+
+  // 最初の出現を一時変数への代入に、残りを一時変数の読み出しに置き換える
+  for (int i = 0; i < occurs_len; i++) {
+    if (!occurs[i].define) continue;
+    Node* expr = *occurs[i].slot;
+    Node* temp = new_temp(expr->type);
+
+    Node* assign = new_binary(ND_ASSIGN, temp, expr);
+    assign->type = temp->type;
+    *occurs[i].slot = assign;
+
+    for (int j = occurs[i].next_same; j >= 0; j = occurs[j].next_same) {
+      if (!occurs[j].reuse) continue;
+      Node* use = new_node(ND_LVAR);
+      use->offset = temp->offset;
+      use->type = temp->type;
+      *occurs[j].slot = use;
+    }
+  }
+
+  free(order);
+  for (int i = 0; i < occurs_len; i++) vn_uses[occurs[i].vn - block_base] = 0;
+  clear_vn();
+  block_base = vn_next;
+  occurs_len = 0;
+}
+
+// 文をたどり、基本ブロックごとに共通部分式を削除する
+void cse_stmt(Node** slot) {
+  Node* node = *slot;
+  switch (node->kind) {
+    case ND_BLOCK:
+      for (int i = 0; i < node->stmts_len; i++) cse_stmt(&node->stmts[i]);
+      return;
+    case ND_RETURN:
+      vn_expr(&node->lhs);
+      cse_flush();
+      return;
+    case ND_IF:
+      vn_expr(&node->cond);
+      cse_flush();
+      cse_stmt(&node->then);
+      cse_flush();
+      if (node->els) {
+        cse_stmt(&node->els);
+        cse_flush();
+      }
+      return;
+    case ND_WHILE:
+      cse_flush();
+      vn_expr(&node->cond);
+      cse_flush();
+      cse_stmt(&node->body);
+      cse_flush();
+      return;
+    case ND_FOR:
+      if (node->init) vn_expr(&node->init);
+      cse_flush();
+      if (node->cond) vn_expr(&node->cond);
+      cse_flush();
+      cse_stmt(&node->body);
+      cse_flush();
+      if (node->inc) vn_expr(&node->inc);
+      cse_flush();
+      return;
+    case ND_SWITCH:
+      vn_expr(&node->cond);
+      cse_flush();
+      cse_stmt(&node->body);
+      cse_flush();
+      return;
+    case ND_CASE:
+      // caseには分岐から合流する
+      cse_flush();
+      cse_stmt(&node->body);
+      return;
+    case ND_BREAK:
+      cse_flush();
+      return;
+    case ND_DECL:
+      return;
+    default:
+      // 式文
+      vn_expr(slot);
+      if (occurs_len >= CSE_MAX_OCCURS) cse_flush();
+      return;
+  }
+}
+
+//
+// ループ不変式の移動
+//
+// ループ内で値の変わらない式をループの前（プリヘッダ）で一度だけ計算し、
+// ループ内では一時変数を読むようにする。関数呼び出しとポインタ経由の
+// ストアは、グローバル変数・アドレスを取られたローカル変数・ポインタの先を
+// すべて書き換えうるものとして扱う。
+//
+
+// ループ内の副作用
+typedef struct {
+  Vector* stores;  // 代入されるND_LVAR/ND_GVAR
+  bool mem_store;  // ポインタ経由のストアがある
+  bool has_call;   // 関数呼び出しがある
+  bool unknown;    // 副作用の分からない式がある
+} LoopEffects;
+
+// ループ内で代入される変数と副作用を集める
+void find_effects(Node* node, LoopEffects* eff) {
+  if (!node) return;
+  switch (node->kind) {
+    case ND_ASSIGN:
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      if (lval_base(node->lhs)->kind == ND_DEREF)
+        eff->mem_store = true;
+      else
+        vec_push(eff->stores, lval_base(node->lhs));
+      break;
+    case ND_CALL:
+      eff->has_call = true;
+      break;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_NUM:
+    case ND_STR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_NOT:
+    case ND_LVAR:
+    case ND_GVAR:
+    case ND_RETURN:
+    case ND_IF:
+    case ND_FOR:
+    case ND_WHILE:
+    case ND_BLOCK:
+    case ND_ADDR:
+    case ND_DEREF:
+    case ND_DECL:
+    case ND_SWITCH:
+    case ND_CASE:
+    case ND_BREAK:
+    case ND_MEMBER:
+    case ND_DATA:
+      break;
+    default:
+      eff->unknown = true;
+      break;
+  }
+  find_effects(node->lhs, eff);
+  find_effects(node->rhs, eff);
+  if (is_compact(node->kind)) return;
+  find_effects(node->cond, eff);
+  find_effects(node->then, eff);
+  find_effects(node->els, eff);
+  find_effects(node->init, eff);
+  find_effects(node->inc, eff);
+  find_effects(node->body, eff);
+  for (int i = 0; i < node->stmts_len; i++) find_effects(node->stmts[i], eff);
+}
+
+// 変数がループ内で代入されるかどうか
+bool is_stored(LoopEffects* eff, Node* var) {
+  for (int i = 0; i < eff->stores->len; i++) {
+    Node* st = eff->stores->data[i];
+    if (st->kind != var->kind) continue;
+    if (var->kind == ND_LVAR && st->offset == var->offset) return true;
+    if (var->kind == ND_GVAR && !strcmp(st->funcname, var->funcname))
+      return true;
+  }
+  return false;
+}
+
+// ポインタ経由で読める変数（グローバル変数、アドレスを取られた
+// ローカル変数）がループ内で書き換えられるかどうか
+bool memory_changes(LoopEffects* eff) {
+  if (eff->mem_store || eff->has_call || eff->unknown) return true;
+  for (int i = 0; i < eff->stores->len; i++) {
+    Node* st = eff->stores->data[i];
+    if (st->kind == ND_GVAR || is_addr_taken(st->offset)) return true;
+  }
+  return false;
+}
+
+// 式の値がループ内で変わらないかどうか
+bool is_invariant(Node* node, LoopEffects* eff) {
+  if (eff->unknown) return node->kind == ND_NUM;
+
+  switch (node->kind) {
+    case ND_NUM:
+    case ND_STR:
+      return true;
+    case ND_LVAR:
+      // 配列はアドレスなので変わらない
+      if (node->type && node->type->ty == ARRAY) return true;
+      if (is_stored(eff, node)) return false;
+      return !is_addr_taken(node->offset) ||
+             (!eff->mem_store && !eff->has_call);
+    case ND_GVAR:
+      if (node->type && node->type->ty == ARRAY) return true;
+      return !is_stored(eff, node) && !eff->mem_store && !eff->has_call;
+    case ND_ADDR:
+      if (node->lhs->kind == ND_LVAR || node->lhs->kind == ND_GVAR)
+        return true;
+      return node->lhs->kind == ND_DEREF &&
+             is_invariant(node->lhs->lhs, eff);
+    case ND_DEREF:
+      return !memory_changes(eff) && is_invariant(node->lhs, eff);
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+      return is_invariant(node->lhs, eff) && is_invariant(node->rhs, eff);
+    case ND_NOT:
+      return is_invariant(node->lhs, eff);
+    default:
+      return false;
+  }
+}
+
+// 式が例外（不正なメモリアクセスやゼロ除算）を起こしうるかどうか
+bool may_trap(Node* node) {
+  if (!node) return false;
+  if (node->kind == ND_DEREF) return true;
+  if (node->kind == ND_DIV &&
+      (node->rhs->kind != ND_NUM || node->rhs->val == 0))
+    return true;
+  return may_trap(node->lhs) || may_trap(node->rhs);
+}
+
+// 2つの式が同じ計算をするかどうか
+bool same_expr(Node* a, Node* b) {
+  if (!a || !b) return a == b;
+  if (a->kind != b->kind || type_key(a) != type_key(b)) return false;
+  // 種類ごとの値は、その種類が使うものだけを比べる
+  switch (a->kind) {
+    case ND_NUM:
+      if (a->val != b->val) return false;
+      break;
+    case ND_STR:
+      if (a->str_label != b->str_label) return false;
+      break;
+    case ND_LVAR:
+      if (a->offset != b->offset) return false;
+      break;
+    case ND_GVAR:
+    case ND_CALL:
+      if (strcmp(a->funcname, b->funcname)) return false;
+      break;
+    case ND_MEMBER:
+      if (a->member != b->member) return false;
+      break;
+    default:
+      break;
+  }
+  return same_expr(a->lhs, b->lhs) && same_expr(a->rhs, b->rhs);
+}
+
+// ループ1つ分の移動の状態
+typedef struct {
+  LoopEffects* eff;
+  Vector* hoisted;  // プリヘッダで計算する式
+  Vector* temps;    // hoisted[i]の値を保持する一時変数
+} Hoister;
+
+void hoist_expr(Node** slot, bool always, Hoister* h);
+
+// 左辺値として評価される式のうち、アドレスの計算を移動する
+void hoist_lval(Node* node, bool always, Hoister* h) {
+  node = lval_base(node);
+  if (node->kind == ND_DEREF) hoist_expr(&node->lhs, always, h);
+}
+
+// 不変な式をプリヘッダに移し、一時変数の読み出しに置き換える。
+// alwaysは、ループに入るたびに必ず評価される位置かどうか
+void hoist_expr(Node** slot, bool always, Hoister* h) {
+  Node* node = *slot;
+
+  switch (node->kind) {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_NOT:
+    case ND_DEREF:
+      if ((node->type &&
+           (node->type->ty == ARRAY || node->type->ty == STRUCT)) ||
+          !is_invariant(node, h->eff) || (!always && may_trap(node)))
+        break;
+
+      // 同じ式がすでに移動されていればその一時変数を使う
+      Node* temp = NULL;
+      for (int i = 0; i < h->hoisted->len; i++)
+        if (same_expr(h->hoisted->data[i], node)) temp = h->temps->data[i];
+      if (!temp) {
+        temp = new_temp(node->type);
+        vec_push(h->hoisted, node);
+        vec_push(h->temps, temp);
+      }
+      Node* use = new_node(ND_LVAR);
+      use->offset = temp->offset;
+      use->type = temp->type;
+      *slot = use;
+      return;
+    default:
+      break;
+  }
+
+  switch (node->kind) {
+    case ND_ASSIGN:
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      hoist_lval(node->lhs, always, h);
+      hoist_expr(&node->rhs, always, h);
+      return;
+    case ND_ADDR:
+    case ND_MEMBER:
+      hoist_lval(node->lhs, always, h);
+      return;
+    case ND_CALL:
+      for (int i = 0; i < node->stmts_len; i++)
+        hoist_expr(&node->stmts[i], always, h);
+      return;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+      hoist_expr(&node->lhs, always, h);
+      hoist_expr(&node->rhs, always, h);
+      return;
+    case ND_LOGAND:
+    case ND_LOGOR:
+      // 右辺は左辺の値によっては評価されない
+      hoist_expr(&node->lhs, always, h);
+      hoist_expr(&node->rhs, false, h);
+      return;
+    case ND_NOT:
+    case ND_DEREF:
+      hoist_expr(&node->lhs, always, h);
+      return;
+    default:
+      return;
+  }
+}
+
+// ループ本体の文から不変な式を探す。
+// 本体は一度も実行されないかもしれないので、例外を起こしうる式は移動しない
+void hoist_stmt(Node** slot, Hoister* h) {
+  Node* node = *slot;
+  switch (node->kind) {
+    case ND_BLOCK:
+      for (int i = 0; i < node->stmts_len; i++) hoist_stmt(&node->stmts[i], h);
+      return;
+    case ND_RETURN:
+      hoist_expr(&node->lhs, false, h);
+      return;
+    case ND_IF:
+      hoist_expr(&node->cond, false, h);
+      hoist_stmt(&node->then, h);
+      if (node->els) hoist_stmt(&node->els, h);
+      return;
+    case ND_WHILE:
+    case ND_FOR:
+      if (node->init) hoist_expr(&node->init, false, h);
+      if (node->cond) hoist_expr(&node->cond, false, h);
+      hoist_stmt(&node->body, h);
+      if (node->inc) hoist_expr(&node->inc, false, h);
+      return;
+    case ND_SWITCH:
+      hoist_expr(&node->cond, false, h);
+      hoist_stmt(&node->body, h);
+      return;
+    case ND_CASE:
+      hoist_stmt(&node->body, h);
+      return;
+    case ND_BREAK:
+    case ND_DECL:
+      return;
+    default:
+      hoist_expr(slot, false, h);
+      return;
+  }
+}
+
+// ループの不変式を移動し、ループを { 初期化式; プリヘッダ; ループ } に置き換える
+void licm_loop(Node** slot) {
+  Node* loop = *slot;
+
+  LoopEffects eff = {0};
+  eff.stores = new_vector();
+  find_effects(loop->cond, &eff);
+  find_effects(loop->body, &eff);
+  find_effects(loop->inc, &eff);
+
+  Hoister h = {0};
+  h.eff = &eff;
+  h.hoisted = new_vector();
+  h.temps = new_vector();
+
+  // 条件式はループに入ると必ず一度は評価される
+  if (loop->cond) hoist_expr(&loop->cond, true, &h);
+  hoist_stmt(&loop->body, &h);
+  if (loop->inc) hoist_expr(&loop->inc, false, &h);
+
+  if (h.hoisted->len == 0) return;
+
+  Vector* stmts = new_vector();
+  if (loop->init) {
+    vec_push(stmts, loop->init);
+    loop->init = NULL;
+  }
+  for (int i = 0; i < h.hoisted->len; i++) {
+    Node* assign = new_binary(ND_ASSIGN, h.temps->data[i], h.hoisted->data[i]);
+    assign->type = h.temps->data[i]->type;
+    vec_push(stmts, assign);
+  }
+  vec_push(stmts, loop);
+
+  Node* block = new_node(ND_BLOCK);
+  block->stmts = stmts->data;
+  block->stmts_len = stmts->len;
+  *slot = block;
+}
+
+// 内側のループから順にループ不変式を移動する
+void licm_stmt(Node** slot) {
+  Node* node = *slot;
+  switch (node->kind) {
+    case ND_BLOCK:
+      for (int i = 0; i < node->stmts_len; i++) licm_stmt(&node->stmts[i]);
+      return;
+    case ND_IF:
+      licm_stmt(&node->then);
+      if (node->els) licm_stmt(&node->els);
+      return;
+    case ND_WHILE:
+    case ND_FOR:
+      licm_stmt(&node->body);
+      licm_loop(slot);
+      return;
+    case ND_SWITCH:
+    case ND_CASE:
+      licm_stmt(&node->body);
+      return;
+    default:
+      return;
+  }
+}
+
+//
+// 単純な配列ループのベクトル化
+//
+//   for (i = A; i < n; i = i + 1) a[i] = b[i] + c[i];
+//
+// のように、ループ変数で添字付けした要素ごとの演算だけからなるループを
+// 見つけてVecLoopの情報を付ける。コード生成では、まずSIMD命令で複数要素
+// ずつ処理し、残りの要素は元のループ（スカラーのエピローグ）で処理する。
+//
+
+// アドレスを取られていないスカラーのローカル変数かどうか
+bool is_plain_lvar(Node* node) {
+  return node->kind == ND_LVAR && node->type && node->type->ty != ARRAY &&
+         !is_addr_taken(node->offset);
+}
+
+// ベクトル化できる配列（またはポインタ変数）の要素のサイズ。できなければ0
+int vec_elem_size(Node* var) {
+  bool ok = ((var->kind == ND_LVAR || var->kind == ND_GVAR) && var->type &&
+             var->type->ty == ARRAY) ||
+            (is_plain_lvar(var) && var->type->ty == PTR);
+  if (!ok || !var->type->ptr_to) return 0;
+  if (var->type->ptr_to->ty == INT) return 4;
+  if (var->type->ptr_to->ty == CHAR) return 1;
+  return 0;
+}
+
+bool is_pointer_var(Node* var) { return var->type->ty == PTR; }
+
+// arr[i]（*(arr + i)）の形ならarrを返す
+Node* vec_array_access(Node* node, Node* index) {
+  if (node->kind != ND_DEREF || node->lhs->kind != ND_ADD) return NULL;
+  Node* addr = node->lhs;
+  if (addr->rhs->kind != ND_LVAR || addr->rhs->offset != index->offset)
+    return NULL;
+  if (!vec_elem_size(addr->lhs)) return NULL;
+  return addr->lhs;
+}
+
+// ループの前に一度だけ読めばよいスカラーかどうか。
+// ポインタ経由の書き込みで変わりうるグローバル変数は、書き込み先が
+// 配列の場合（別のオブジェクトを指せない場合）だけ許す
+bool vec_scalar_ok(Node* node, Node* index, Node* dst) {
+  if (node->kind == ND_NUM) return true;
+  if (!node->type || (node->type->ty != INT && node->type->ty != CHAR))
+    return false;
+  if (is_plain_lvar(node)) return node->offset != index->offset;
+  return node->kind == ND_GVAR && !is_pointer_var(dst);
+}
+
+// i = i + 1、i += 1、++i、i++ の形かどうか
+bool is_increment(Node* node, Node* index) {
+  if ((node->kind == ND_ADD_ASSIGN || node->kind == ND_POST_INC) &&
+      node->lhs->kind == ND_LVAR && node->lhs->offset == index->offset)
+    return node->rhs->kind == ND_NUM && node->rhs->val == 1;
+  if (node->kind != ND_ASSIGN || node->lhs->kind != ND_LVAR ||
+      node->lhs->offset != index->offset || node->rhs->kind != ND_ADD)
+    return false;
+  Node* lhs = node->rhs->lhs;
+  Node* rhs = node->rhs->rhs;
+  if (rhs->kind == ND_LVAR) {
+    Node* tmp = lhs;
+    lhs = rhs;
+    rhs = tmp;
+  }
+  return lhs->kind == ND_LVAR && lhs->offset == index->offset &&
+         rhs->kind == ND_NUM && rhs->val == 1;
+}
+
+// ループの右辺の被演算子を登録する
+bool vec_add_src(VecLoop* vec, Node* node) {
+  Node* arr = vec_array_access(node, vec->index);
+  int k = vec->nsrc++;
+  if (arr) {
+    if (vec_elem_size(arr) != vec->elem_size) return false;
+    vec->src[k] = arr;
+    vec->is_array[k] = true;
+    return true;
+  }
+  vec->src[k] = node;
+  return vec_scalar_ok(node, vec->index, vec->dst);
+}
+
+// for文がベクトル化できれば、その情報を作る
+VecLoop* vectorize_loop(Node* node) {
+  if (!node->cond || !node->inc) return NULL;
+
+  // 条件式: i < n または i <= n
+  Node* cond = node->cond;
+  if ((cond->kind != ND_LT && cond->kind != ND_LE) || !is_plain_lvar(cond->lhs) ||
+      cond->lhs->type->ty != INT)
+    return NULL;
+
+  VecLoop* vec = arena_alloc(sizeof(VecLoop));
+  vec->index = cond->lhs;
+  vec->limit = cond->rhs;
+  vec->inclusive = cond->kind == ND_LE;
+
+  if (!is_increment(node->inc, vec->index)) return NULL;
+
+  // 本体: a[i] = 式; だけ
+  Node* body = node->body;
+  if (body->kind == ND_BLOCK && body->stmts_len == 1) body = body->stmts[0];
+  if (body->kind != ND_ASSIGN) return NULL;
+
+  vec->dst = vec_array_access(body->lhs, vec->index);
+  if (!vec->dst) return NULL;
+  vec->elem_size = vec_elem_size(vec->dst);
+  if (!vec_scalar_ok(vec->limit, vec->index, vec->dst)) return NULL;
+
+  Node* rhs = body->rhs;
+  if (rhs->kind == ND_ADD || rhs->kind == ND_SUB || rhs->kind == ND_MUL) {
+    vec->op = rhs->kind;
+    if (!vec_add_src(vec, rhs->lhs) || !vec_add_src(vec, rhs->rhs))
+      return NULL;
+    // SSE2には32ビット整数の乗算がなく、8ビットの乗算はどちらにもない
+    if (vec->op == ND_MUL && (vec->elem_size != 4 || !ctx->opt_avx2))
+      return NULL;
+  } else {
+    if (!vec_add_src(vec, rhs)) return NULL;
+  }
+  return vec;
+}
+
+void vectorize_stmt(Node* node) {
+  switch (node->kind) {
+    case ND_BLOCK:
+      for (int i = 0; i < node->stmts_len; i++) vectorize_stmt(node->stmts[i]);
+      return;
+    case ND_IF:
+      vectorize_stmt(node->then);
+      if (node->els) vectorize_stmt(node->els);
+      return;
+    case ND_WHILE:
+    case ND_SWITCH:
+    case ND_CASE:
+      vectorize_stmt(node->body);
+      return;
+    case ND_FOR:
+      vectorize_stmt(node->body);
+      node->vec = vectorize_loop(node);
+      return;
+    default:
+      return;
+  }
+}
+
+// 関数定義に最適化をかける
+void optimize(Node* func) {
+  cur_func = func;
+  addr_taken_len = 0;
+  find_addr_taken(func->body);
+  assign_param_regs(func);
+
+  licm_stmt(&func->body);
+  vectorize_stmt(func->body);
+
+  // 表の要素は関数ごとに解放されるので、前の関数の要素を残さない
+  memset(vn_buckets, 0, sizeof(vn_buckets));
+  clear_vn();
+  block_base = vn_next;
+  cse_stmt(&func->body);
+  cse_flush();
+}
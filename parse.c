@@ -1,158 +1,564 @@
 #include "9cc.h"
 
-// グローバル変数の実体
-Node* code[100];
-LVar* locals;
-GVar* globals;
-Vector* stms;
-Type* type;
-Str_vec* strings;
+// 現在着目しているトークンからn個先のトークン。入力の終わりより先は
+// 最後のTK_EOFを返す
+Token* peek(int n) {
+  int i = ctx->pos + n;
+  return &ctx->tokens[i < ctx->ntokens ? i : ctx->ntokens - 1];
+}
+
+// トークンの文字列の先頭
+char* tok_str(Token* tok) { return ctx->user_input + tok->loc; }
+
+// ノードの行番号と桁番号から、ソース上の位置を求める
+char* node_str(Node* node) {
+  char* p = ctx->user_input;
+  for (int line = 1; line < node->line && *p; p++)
+    if (*p == '\n') line++;
+  return node->col ? p + node->col - 1 : p;
+}
 
 // 変数を名前で検索する。見つからなかった場合はNULLを返す。
 LVar* find_lvar(Token* tok) {
-  for (LVar* var = locals; var; var = var->next)
-    if (var->len == tok->len && !memcmp(tok->str, var->name, var->len))
+  for (LVar* var = ctx->locals; var; var = var->next)
+    if (var->len == tok->len && !memcmp(tok_str(tok), var->name, var->len))
       return var;
   return NULL;
 }
 
 // グローバル変数を検索する。見つからなかった場合はNULLを返す。
 GVar* find_gvar(Token* tok) {
-  for (GVar* var = globals; var; var = var->next)
-    if (var->len == tok->len && !memcmp(tok->str, var->name, var->len))
+  for (GVar* var = ctx->globals; var; var = var->next)
+    if (var->len == tok->len && !memcmp(tok_str(tok), var->name, var->len))
       return var;
   return NULL;
 }
 
+// 関数を名前で検索する。見つからなかった場合はNULLを返す。
+Node* find_func(char* name) {
+  if (!ctx->funcs) return NULL;
+  for (int i = 0; i < ctx->funcs->len; i++)
+    if (!strcmp(ctx->funcs->data[i]->funcname, name))
+      return ctx->funcs->data[i];
+  return NULL;
+}
+
+Type* new_type(int ty, Type* ptr_to) {
+  Type* type = arena_alloc(sizeof(Type));
+  type->ty = ty;
+  type->ptr_to = ptr_to;
+  return type;
+}
+
+// ローカル変数を作ってlocalsに追加する。
+// 変数は型のサイズ分だけ、型のアラインメントに揃えて確保する
+LVar* new_lvar(Token* tok, Type* type) {
+  LVar* lvar = arena_alloc(sizeof(LVar));
+  lvar->next = ctx->locals;
+  lvar->name = tok_str(tok);
+  lvar->len = tok->len;
+  lvar->type = type;
+  int offset = ctx->locals ? ctx->locals->offset : 0;
+  lvar->offset = align_to(offset + size_of(type), align_of(type));
+  ctx->locals = lvar;
+  return lvar;
+}
+
 // 次のトークンが期待している記号のときには、トークンを1つ読み進めて
 // 真を返す。それ以外の場合には偽を返す。
-bool consume(char* op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
-    return false;
-  token = token->next;
+// 記号の種類はtokenizeで決めてあるので、文字列は比べない
+bool consume(TokenKind op) {
+  if (peek(0)->kind != op) return false;
+  ctx->pos++;
   return true;
 }
 
 // 型の前半を読んでtokenを進める。型を返す
+// 次のトークンが型名の始まりかどうか
+bool is_typename() {
+  TokenKind kind = peek(0)->kind;
+  return kind == TK_INT || kind == TK_CHAR || kind == TK_STRUCT;
+}
+
 Type* consume_type() {
-  if (token->kind != TK_INT && token->kind != TK_CHAR) {
+  if (!is_typename()) {
     error("型ではありません");
   }
-  Type* type = calloc(1, sizeof(Type));
-  if (token->kind == TK_INT) {
-    type->ty = INT;
-  } else if (token->kind == TK_CHAR) {
-    type->ty = CHAR;
+  Type* type;
+  if (peek(0)->kind == TK_STRUCT) {
+    ctx->pos++;
+    // 構造体の型とメンバは関数の外でも使うので、アリーナには置かない
+    bool use_arena = ctx->use_arena;
+    ctx->use_arena = false;
+    type = struct_decl();
+    ctx->use_arena = use_arena;
+  } else {
+    type = arena_alloc(sizeof(Type));
+    if (peek(0)->kind == TK_INT) {
+      type->ty = INT;
+    } else {
+      type->ty = CHAR;
+    }
+    ctx->pos++;
   }
-  token = token->next;
-  while (consume("*")) {
-    Type* new_type = calloc(1, sizeof(Type));
-    new_type->ty = PTR;
-    new_type->ptr_to = type;
-    type = new_type;
+  while (consume(TK_STAR)) type = new_type(PTR, type);
+  return type;
+}
+
+// 型の後の[N]を読んで配列型にする。
+// []なら大きさは0のままにして、初期化子の要素数で決める
+Type* array_suffix(Type* type) {
+  if (!consume(TK_LBRACKET)) return type;
+  Type* array_type = arena_alloc(sizeof(Type));
+  array_type->ty = ARRAY;
+  if (!consume(TK_RBRACKET)) {
+    array_type->array_size = expect_number();
+    expect(TK_RBRACKET);
   }
+  array_type->ptr_to = type;  // 配列の要素型
+  return array_type;
+}
 
-  return type;
+// 文字列リテラルのエスケープを解釈した1文字を返し、*pを次の文字に進める
+int read_char(char** p) {
+  char c = *(*p)++;
+  if (c != '\\') return c;
+  switch (c = *(*p)++) {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case '0':
+      return 0;
+    default:
+      return c;
+  }
 }
 
-bool is_next_token(char* op) {
-  if (memcmp(token->next->str, op, token->next->len) == 0) {
-    return true;
+// 初期化子を読み、要素の式を並べて返す。スカラーなら要素は1つ。
+// 配列は{...}で、charの配列は文字列リテラルでも初期化できる。
+// 足りない要素は0になる
+Node** initializer(Type* type, int* len) {
+  Vector* elems = new_vector();
+  if (type->ty == STRUCT ||
+      (type->ty == ARRAY && is_aggregate(type->ptr_to)))
+    error_at(tok_str(peek(0)), "この型の初期化子には対応していません");
+
+  if (type->ty == ARRAY && type->ptr_to->ty == CHAR &&
+      peek(0)->kind == TK_STR) {
+    char* p = tok_str(peek(0));
+    while (p < tok_str(peek(0)) + peek(0)->len)
+      vec_push(elems, new_node_num(read_char(&p)));
+    // 終端の'\0'は、入りきらなければ付けない
+    if (!type->array_size || elems->len < type->array_size)
+      vec_push(elems, new_node_num(0));
+    ctx->pos++;
+  } else if (type->ty == ARRAY) {
+    expect(TK_LBRACE);
+    while (!consume(TK_RBRACE)) {
+      vec_push(elems, assign());
+      if (!consume(TK_COMMA)) {
+        expect(TK_RBRACE);
+        break;
+      }
+    }
   } else {
-    return false;
+    vec_push(elems, assign());
+  }
+
+  if (type->ty == ARRAY && type->array_size &&
+      elems->len > type->array_size)
+    error_at(tok_str(peek(0)), "初期化子の要素が多すぎます");
+  *len = elems->len;
+  return elems->data;
+}
+
+// ローカル配列の初期化。要素がすべて整数の定数なら、.rodataに置いた
+// 初期値からブロックコピーする。そうでなければ0で埋めてから要素を代入する
+Node* local_array_init(Node* var, Node** init, int len) {
+  bool is_const = true;
+  for (int i = 0; i < len; i++)
+    if (!is_const_expr(init[i])) is_const = false;
+
+  if (is_const) {
+    Node* data = new_node(ND_DATA);
+    data->type = var->type;
+    data->stmts = init;
+    data->stmts_len = len;
+    return new_assign(var, data);
+  }
+
+  Node* clear = new_node(ND_CALL);
+  clear->funcname = "__builtin_memset";
+  clear->type = new_type(PTR, new_type(CHAR, NULL));
+  clear->stmts = arena_alloc(3 * sizeof(Node*));
+  clear->stmts[0] = var;
+  clear->stmts[1] = new_node_num(0);
+  clear->stmts[2] = new_node_num(size_of(var->type));
+  clear->stmts_len = 3;
+
+  Vector* stmts = new_vector();
+  vec_push(stmts, clear);
+  for (int i = 0; i < len; i++) {
+    Node* elem = new_node(ND_DEREF);
+    elem->lhs = new_add(var, new_node_num(i));
+    elem->type = var->type->ptr_to;
+    vec_push(stmts, new_assign(elem, init[i]));
+  }
+  Node* node = new_node(ND_BLOCK);
+  node->stmts = stmts->data;
+  node->stmts_len = stmts->len;
+  return node;
+}
+
+// 整数の定数式かどうか
+bool is_const_expr(Node* node) {
+  switch (node->kind) {
+    case ND_NUM:
+      return true;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+      return !is_pointer(node->type) && is_const_expr(node->lhs) &&
+             is_const_expr(node->rhs);
+    case ND_NOT:
+      return is_const_expr(node->lhs);
+    default:
+      return false;
   }
 }
 
+// 定数式をコンパイル時に計算する
+long eval(Node* node) {
+  char* label;
+  long val = eval_reloc(node, &label);
+  if (label) error_at(node_str(node), "初期化子が定数式ではありません");
+  return val;
+}
+
+// グローバル変数の初期値になる定数式を計算する。文字列リテラルや
+// グローバル変数のアドレスなら、*labelにそのシンボルを入れて
+// シンボルからのバイト単位のオフセットを返す
+long eval_reloc(Node* node, char** label) {
+  *label = NULL;
+  switch (node->kind) {
+    case ND_NUM:
+      return node->val;
+    case ND_STR:
+      *label = calloc(1, 32);
+      sprintf(*label, ".L.str%d", node->str_label);
+      return 0;
+    case ND_GVAR:
+      if (node->type->ty != ARRAY) break;
+      // 配列はその先頭のアドレス
+      *label = calloc(1, strlen(node->funcname) + sizeof(GVAR_PREFIX));
+      sprintf(*label, GVAR_PREFIX "%s", node->funcname);
+      return 0;
+    case ND_ADDR:
+      if (node->lhs->kind == ND_GVAR) {
+        *label =
+            calloc(1, strlen(node->lhs->funcname) + sizeof(GVAR_PREFIX));
+        sprintf(*label, GVAR_PREFIX "%s", node->lhs->funcname);
+        return 0;
+      }
+      if (node->lhs->kind == ND_DEREF) return eval_reloc(node->lhs->lhs, label);
+      break;
+    case ND_ADD:
+    case ND_SUB:
+      if (is_pointer(node->type)) {
+        // ポインタに整数を足し引きする
+        long val = eval_reloc(node->lhs, label);
+        long n = eval(node->rhs) * size_of(node->lhs->type->ptr_to);
+        return node->kind == ND_ADD ? val + n : val - n;
+      }
+      return node->kind == ND_ADD ? eval(node->lhs) + eval(node->rhs)
+                                  : eval(node->lhs) - eval(node->rhs);
+    case ND_MUL:
+      return eval(node->lhs) * eval(node->rhs);
+    case ND_DIV: {
+      long rhs = eval(node->rhs);
+      if (!rhs) error("定数式で0で割っています");
+      return eval(node->lhs) / rhs;
+    }
+    case ND_EQ:
+      return eval(node->lhs) == eval(node->rhs);
+    case ND_NE:
+      return eval(node->lhs) != eval(node->rhs);
+    case ND_LE:
+      return eval(node->lhs) <= eval(node->rhs);
+    case ND_LT:
+      return eval(node->lhs) < eval(node->rhs);
+    case ND_LOGAND:
+      return eval(node->lhs) && eval(node->rhs);
+    case ND_LOGOR:
+      return eval(node->lhs) || eval(node->rhs);
+    case ND_NOT:
+      return !eval(node->lhs);
+    default:
+      break;
+  }
+  error_at(node_str(node), "初期化子が定数式ではありません");
+}
+
+StructTag* find_tag(Token* tok) {
+  for (StructTag* tag = ctx->tags; tag; tag = tag->next)
+    if (tag->len == tok->len && !memcmp(tok_str(tok), tag->name, tag->len))
+      return tag;
+  return NULL;
+}
+
+// structに続くタグとメンバの宣言を読んで構造体の型を返す。
+// メンバはそれぞれの型のアラインメントに揃えて並べ、
+// 全体のサイズはメンバの最大のアラインメントの倍数に切り上げる
+Type* struct_decl() {
+  Token* tok = consume_ident();
+  if (tok && !consume(TK_LBRACE)) {
+    StructTag* tag = find_tag(tok);
+    if (!tag) error_at(tok_str(tok), "構造体が宣言されていません");
+    return tag->type;
+  }
+  if (!tok) expect(TK_LBRACE);
+
+  Type* type = calloc(1, sizeof(Type));
+  type->ty = STRUCT;
+  type->align = 1;
+  type->incomplete = true;
+
+  // メンバが自分自身へのポインタを持てるように、先にタグを登録する
+  if (tok) {
+    StructTag* tag = calloc(1, sizeof(StructTag));
+    tag->next = ctx->tags;
+    tag->name = tok_str(tok);
+    tag->len = tok->len;
+    tag->type = type;
+    ctx->tags = tag;
+  }
+
+  Member head = {0};
+  Member* cur = &head;
+  int offset = 0;
+  while (!consume(TK_RBRACE)) {
+    Type* mtype = consume_type();
+    Token* name = consume_ident();
+    if (!name) error_at(tok_str(peek(0)), "メンバ名がありません");
+
+    mtype = array_suffix(mtype);
+    // 要素数を省略した配列は最後のメンバ（フレキシブル配列メンバ）にだけ置ける
+    bool flexible = mtype->ty == ARRAY && !mtype->array_size &&
+                    peek(1)->kind == TK_RBRACE;
+    if (is_incomplete(flexible ? mtype->ptr_to : mtype))
+      error_at(tok_str(name), "メンバの型が不完全です");
+    expect(TK_SEMI);
+
+    Member* mem = calloc(1, sizeof(Member));
+    mem->name = tok_str(name);
+    mem->len = name->len;
+    mem->type = mtype;
+    offset = align_to(offset, align_of(mtype));
+    mem->offset = offset;
+    offset += size_of(mtype);
+    if (type->align < align_of(mtype)) type->align = align_of(mtype);
+    cur = cur->next = mem;
+  }
+  type->members = head.next;
+  type->size = align_to(offset, type->align);
+  type->incomplete = false;
+  return type;
+}
+
+// 構造体のメンバへのアクセスnode.nameのノードを作る
+Node* struct_ref(Node* node) {
+  Token* tok = consume_ident();
+  if (!tok) error_at(tok_str(peek(0)), "メンバ名がありません");
+  if (!node->type || node->type->ty != STRUCT)
+    error_at(tok_str(tok), "構造体ではありません");
+
+  Member* mem = node->type->members;
+  while (mem &&
+         (mem->len != tok->len || memcmp(mem->name, tok_str(tok), tok->len)))
+    mem = mem->next;
+  if (!mem) error_at(tok_str(tok), "そのようなメンバはありません");
+
+  Node* ref = new_node(ND_MEMBER);
+  set_loc(ref, tok);
+  ref->lhs = node;
+  ref->member = mem;
+  ref->type = mem->type;
+  return ref;
+}
+
+// 着目しているトークンの1つ先が期待している記号かどうか
+bool is_next_token(TokenKind op) { return peek(1)->kind == op; }
+
 // ここではtokenの情報を返す。tokenを一つ読み進める
 Token* consume_ident() {
-  if (token->kind != TK_IDENT) return NULL;
-  Token* tok = token;
-  token = token->next;
+  if (peek(0)->kind != TK_IDENT) return NULL;
+  Token* tok = peek(0);
+  ctx->pos++;
   return tok;
 }
 
 bool consume_return() {
-  if (token->kind != TK_RETURN) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_RETURN) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_int() {
-  if (token->kind != TK_INT) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_INT) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_if() {
-  if (token->kind != TK_IF) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_IF) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_while() {
-  if (token->kind != TK_WHILE) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_WHILE) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_for() {
-  if (token->kind != TK_FOR) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_FOR) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_else() {
-  if (token->kind != TK_ELSE) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_ELSE) return false;
+  ctx->pos++;
+  return true;
+}
+
+bool consume_switch() {
+  if (peek(0)->kind != TK_SWITCH) return false;
+  ctx->pos++;
+  return true;
+}
+
+bool consume_case() {
+  if (peek(0)->kind != TK_CASE) return false;
+  ctx->pos++;
+  return true;
+}
+
+bool consume_default() {
+  if (peek(0)->kind != TK_DEFAULT) return false;
+  ctx->pos++;
+  return true;
+}
+
+bool consume_break() {
+  if (peek(0)->kind != TK_BREAK) return false;
+  ctx->pos++;
   return true;
 }
 
 bool consume_sizeof() {
-  if (token->kind != TK_SIZEOF) return false;
-  token = token->next;
+  if (peek(0)->kind != TK_SIZEOF) return false;
+  ctx->pos++;
   return true;
 }
 
 // プログラムの終わり
-bool at_eof() { return token->kind == TK_EOF; }
+bool at_eof() { return peek(0)->kind == TK_EOF; }
 
 // 次のトークンが期待している記号のときには、トークンを1つ読み進める。
 // それ以外の場合にはエラーを報告する。
-void expect(char* op) {
-  if (token->kind != TK_RESERVED || strlen(op) != token->len ||
-      memcmp(token->str, op, token->len))
-    error_at(token->str, op, "expected \"%s\"");
-  token = token->next;
+void expect(TokenKind op) {
+  if (peek(0)->kind != op)
+    error_at(tok_str(peek(0)), "expected \"%s\"", punct_str[op]);
+  ctx->pos++;
 }
 
 // 次のトークンが数値の場合、トークンを1つ読み進めてその数値を返す。
 // それ以外の場合にはエラーを報告する。
 int expect_number() {
-  if (token->kind != TK_NUM)
-    error_at(token->str, user_input, "数ではありません");
-  int val = token->val;
-  token = token->next;
+  if (peek(0)->kind != TK_NUM)
+    error_at(tok_str(peek(0)), "数ではありません");
+  int val = peek(0)->val;
+  ctx->pos++;
   return val;
 }
 
 // 次のトークンがintの場合、トークンを1つ読み進める。
 // それ以外の場合にはエラーを報告する。
 void expect_int() {
-  if (token->kind != TK_INT) {
-    error_at(token->str, user_input, "int型が必要です");
+  if (peek(0)->kind != TK_INT) {
+    error_at(tok_str(peek(0)), "int型が必要です");
+  }
+  ctx->pos++;
+}
+
+// 文、関数呼び出し、関数定義のフィールド（cond以降）を持たない種類か
+bool is_compact(NodeKind kind) {
+  switch (kind) {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_NUM:
+    case ND_CHAR:
+    case ND_STR:
+    case ND_EQ:
+    case ND_NE:
+    case ND_LE:
+    case ND_LT:
+    case ND_LOGAND:
+    case ND_LOGOR:
+    case ND_NOT:
+    case ND_ASSIGN:
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+    case ND_LVAR:
+    case ND_GVAR:
+    case ND_ADDR:
+    case ND_DEREF:
+    case ND_MEMBER:
+      return true;
+    default:
+      return false;
   }
-  token = token->next;
 }
 
+// ノードの位置は、作った時点で着目しているトークンの位置にする。
+// 式のノードは種類ごとの値までしか確保しない
 Node* new_node(NodeKind kind) {
-  Node* node = calloc(1, sizeof(Node));
+  size_t size = is_compact(kind) ? offsetof(Node, cond) : sizeof(Node);
+  Node* node = arena_alloc(size);
   node->kind = kind;
+  if (ctx->tokens) set_loc(node, peek(0));
   return node;
 }
 
+// ノードの位置をトークンの位置にする
+void set_loc(Node* node, Token* tok) {
+  node->line = tok->line;
+  node->col = tok->col;
+}
+
+// 二項演算の位置は左辺の位置にする
 Node* new_binary(NodeKind kind, Node* lhs, Node* rhs) {
   Node* node = new_node(kind);
+  node->line = lhs->line;
+  node->col = lhs->col;
   node->lhs = lhs;
   node->rhs = rhs;
   return node;
@@ -163,14 +569,16 @@ Node* new_node_num(int val) {
   Node* node = new_node(ND_NUM);
   node->val = val;
 
-  Type* type = calloc(1, sizeof(Type));
-  type->ty = INT;
-  node->type = type;
+  node->type = new_type(INT, NULL);
   return node;
 }
 
 Node* top_level() {
-  type = consume_type();
+  Type* type = consume_type();
+
+  // 構造体の宣言だけの場合: struct foo { ... };
+  if (consume(TK_SEMI)) return new_node(ND_DECL);
+
   Token* tok = consume_ident();
 
   if (!tok) {
@@ -179,40 +587,45 @@ Node* top_level() {
 
   // consume_ident()の後、tokenは次のトークンを指しているので、
   // 現在のtokenが"("かどうかを確認
-  if (token->kind == TK_RESERVED && token->len == 1 && token->str[0] == '(') {
-    return function(tok);
+  if (peek(0)->kind == TK_LPAREN) {
+    return function(tok, type);
   } else {
-    return global_def(tok);
+    return global_def(tok, type);
   }
 }
 
-Node* global_def(Token* tok) {
+Node* global_def(Token* tok, Type* type) {
   // グローバル変数宣言
   GVar* gvar = calloc(1, sizeof(GVar));
-  gvar->next = globals;
-  gvar->name = strndup(tok->str, tok->len);
+  gvar->next = ctx->globals;
+  gvar->name = strndup(tok_str(tok), tok->len);
   gvar->len = tok->len;
 
-  // 配列だった時: int a[10]など
-  if (consume("[")) {
-    Type* array_type = calloc(1, sizeof(Type));
-    array_type->ty = ARRAY;
-    array_type->array_size = expect_number();
-    array_type->ptr_to = type;  // 配列の要素型
-    type = array_type;
-    expect("]");
+  type = array_suffix(type);
+  if (consume(TK_ASSIGN)) {
+    // 初期値はコンパイル時に計算して.dataに置く
+    gvar->init = initializer(type, &gvar->init_len);
+    for (int i = 0; i < gvar->init_len; i++) {
+      char* label;
+      eval_reloc(gvar->init[i], &label);
+      if (label && !is_pointer(gvar->init[i]->type))
+        error_at(node_str(gvar->init[i]), "初期化子が定数式ではありません");
+    }
+    if (type->ty == ARRAY && !type->array_size)
+      type->array_size = gvar->init_len;
   }
 
   gvar->type = type;
 
   // オフセットを計算
-  if (globals) {
+  if (ctx->globals) {
     if (type->ty == ARRAY) {
       // 配列の場合: 配列サイズ × 要素のサイズ
-      gvar->offset = globals->offset + type->array_size * size_of(type->ptr_to);
+      gvar->offset =
+          ctx->globals->offset + type->array_size * size_of(type->ptr_to);
     } else {
       // スカラー変数：型のサイズを使う
-      gvar->offset = globals->offset + size_of(type);
+      gvar->offset = ctx->globals->offset + size_of(type);
     }
   } else {
     if (type->ty == ARRAY) {
@@ -223,9 +636,9 @@ Node* global_def(Token* tok) {
       gvar->offset = size_of(type);
     }
   }
-  globals = gvar;
+  ctx->globals = gvar;
 
-  expect(";");
+  expect(TK_SEMI);
   // 変数宣言は式として値を返さないので空のノードを返す
   Node* node = new_node(ND_DECL);
   node->offset = gvar->offset;
@@ -234,319 +647,368 @@ Node* global_def(Token* tok) {
 }
 
 // 関数定義をパース
-Node* function(Token* tok) {
+Node* function(Token* tok, Type* type) {
   // 新しい関数を解析するので、ローカル変数リストをリセット
-  locals = NULL;
+  ctx->locals = NULL;
+  ctx->nbranches = 0;
 
   Node* node = new_node(ND_FUNC);
-  node->funcname = strndup(tok->str, tok->len);
+  set_loc(node, tok);
+  node->funcname = strndup(tok_str(tok), tok->len);
   node->type = type;
+  if (type->ty == STRUCT)
+    error_at(tok_str(tok), "構造体を返す関数には対応していません");
+
+  // 再帰呼び出しでも戻り値の型が分かるように、本体より先に登録する
+  if (!ctx->funcs) ctx->funcs = new_vector();
+  vec_push(ctx->funcs, node);
+
+  // 引数と本体の構文木、ローカル変数はアリーナに置く
+  ctx->use_arena = true;
 
   // 引数リストをパース
-  expect("(");
+  expect(TK_LPAREN);
   Vector* params = new_vector();
 
-  if (!consume(")")) {
-    Type* arg_type = consume_type();
-    Token* param = consume_ident();
+  if (!consume(TK_RPAREN)) {
+    do {
+      Type* arg_type = consume_type();
+      Token* param = consume_ident();
+      if (!param) error("引数名がありません");
+      if (arg_type->ty == STRUCT)
+        error_at(tok_str(param), "構造体の値渡しには対応していません");
 
-    if (param) {
+      LVar* lvar = new_lvar(param, arg_type);
       Node* p = new_node(ND_LVAR);
-      p->offset = 8;  // 引数の最初のオフセット
+      p->offset = lvar->offset;
+      p->type = arg_type;
       vec_push(params, p);
-
-      LVar* lvar = calloc(1, sizeof(LVar));
-      lvar->next = locals;
-      lvar->name = param->str;
-      lvar->len = param->len;
-      lvar->offset = 8;
-      lvar->type = arg_type;
-      locals = lvar;
-
-      while (consume(",")) {
-        arg_type = consume_type();
-        param = consume_ident();
-        if (!param) error("引数名がありません");
-
-        p = new_node(ND_LVAR);
-        p->offset = locals->offset + 8;
-        vec_push(params, p);
-
-        lvar = calloc(1, sizeof(LVar));
-        lvar->next = locals;
-        lvar->name = param->str;
-        lvar->len = param->len;
-        lvar->offset = locals->offset + 8;
-        lvar->type = arg_type;
-        locals = lvar;
-      }
-    }
-    expect(")");
+    } while (consume(TK_COMMA));
+    expect(TK_RPAREN);
   }
 
   node->params = params->data;
   node->params_len = params->len;
-  free(params);
 
   // 関数本体をパース
   node->body = stmt();
+  node->stack_size = ctx->locals ? ctx->locals->offset : 0;
+  node->branch_id = ctx->nbranches;
+  ctx->use_arena = false;
   return node;
 }
 
+// プログラム全体を解析する。関数定義はctx->funcsに、
+// グローバル変数はctx->globalsに集まる
 void program() {
-  int i = 0;
-
   // 関数定義またはグローバル変数定義
-  while (!at_eof()) {
-    code[i++] = top_level();
-  }
-  code[i] = NULL;
+  while (!at_eof()) top_level();
 }
 
 Node* stmt() {
   Node* node;
+  Token* start = peek(0);  // 文の位置は先頭のトークンの位置にする
 
-  if (consume("{")) {  // ブロックの開始
+  if (consume(TK_LBRACE)) {  // ブロックの開始
     node = new_node(ND_BLOCK);
     Vector* stmts = new_vector();
 
-    while (!consume("}")) {  // `}` が出現するまで繰り返す
+    while (!consume(TK_RBRACE)) {  // `}` が出現するまで繰り返す
       if (at_eof()) {
-        error_at(token->str, user_input, "'}'が見つかりません");
+        error_at(tok_str(peek(0)), "'}'が見つかりません");
       }
       vec_push(stmts, stmt());
     }
 
     node->stmts = stmts->data;
     node->stmts_len = stmts->len;
-    free(stmts);  // Vector 構造体自体は解放
+    set_loc(node, start);
     return node;
   }
 
   if (consume_return()) {
     node = new_node(ND_RETURN);
     node->lhs = expr();  // 式を解析して左辺に格納
-    expect(";");
+    expect(TK_SEMI);
+    set_loc(node, start);
     return node;
   }
 
   if (consume_if()) {
     node = new_node(ND_IF);
-    expect("(");
+    node->branch_id = ctx->nbranches++;
+    expect(TK_LPAREN);
     node->cond = expr();  // 条件式
-    expect(")");
+    expect(TK_RPAREN);
     node->then = stmt();                     // then ブロック
     if (consume_else()) node->els = stmt();  // else ブロック（オプション）
+    set_loc(node, start);
     return node;
   }
 
   if (consume_while()) {
     node = new_node(ND_WHILE);
-    expect("(");
+    expect(TK_LPAREN);
     node->cond = expr();  // 条件式
-    expect(")");
+    expect(TK_RPAREN);
+    ctx->breakable++;
     node->body = stmt();  // ループ本体
+    ctx->breakable--;
+    set_loc(node, start);
     return node;
   }
 
   if (consume_for()) {
     node = new_node(ND_FOR);
-    expect("(");
-    if (!consume(";")) {
+    expect(TK_LPAREN);
+    if (!consume(TK_SEMI)) {
       node->init = expr();  // 初期化式
-      expect(";");
+      expect(TK_SEMI);
     }
-    if (!consume(";")) {
+    if (!consume(TK_SEMI)) {
       node->cond = expr();  // 条件式
-      expect(";");
+      expect(TK_SEMI);
     }
-    if (!consume(")")) {
+    if (!consume(TK_RPAREN)) {
       node->inc = expr();  // 更新式
-      expect(")");
+      expect(TK_RPAREN);
     }
+    ctx->breakable++;
     node->body = stmt();  // ループ本体
+    ctx->breakable--;
+    set_loc(node, start);
     return node;
   }
 
-  // 変数の宣言（intまたはchar）
-  if (token->kind == TK_INT || token->kind == TK_CHAR) {
+  // switch文。caseとdefaultは解析中のswitch文のリストに繋ぐ
+  if (consume_switch()) {
+    node = new_node(ND_SWITCH);
+    expect(TK_LPAREN);
+    node->cond = expr();
+    expect(TK_RPAREN);
+    Node* sw = ctx->cur_switch;
+    ctx->cur_switch = node;
+    ctx->breakable++;
+    node->body = stmt();
+    ctx->breakable--;
+    ctx->cur_switch = sw;
+    set_loc(node, start);
+    return node;
+  }
+
+  if (consume_case()) {
+    if (!ctx->cur_switch)
+      error_at(tok_str(start), "switch文の外にcaseがあります");
+    node = new_node(ND_CASE);
+    node->val = consume(TK_MINUS) ? -expect_number() : expect_number();
+    for (Node* c = ctx->cur_switch->case_next; c; c = c->case_next)
+      if (c->val == node->val)
+        error_at(tok_str(start), "caseの値%dが重複しています", node->val);
+    expect(TK_COLON);
+    node->case_next = ctx->cur_switch->case_next;
+    ctx->cur_switch->case_next = node;
+    node->body = stmt();
+    set_loc(node, start);
+    return node;
+  }
+
+  if (consume_default()) {
+    if (!ctx->cur_switch)
+      error_at(tok_str(start), "switch文の外にdefaultがあります");
+    if (ctx->cur_switch->default_case)
+      error_at(tok_str(start), "defaultが重複しています");
+    node = new_node(ND_CASE);
+    expect(TK_COLON);
+    ctx->cur_switch->default_case = node;
+    node->body = stmt();
+    set_loc(node, start);
+    return node;
+  }
+
+  if (consume_break()) {
+    if (!ctx->breakable)
+      error_at(tok_str(start), "ループやswitch文の外にbreakがあります");
+    node = new_node(ND_BREAK);
+    expect(TK_SEMI);
+    set_loc(node, start);
+    return node;
+  }
+
+  // 変数の宣言（int、charまたはstruct）
+  if (is_typename()) {
     Type* typ = consume_type();
 
+    // 構造体の宣言だけの場合: struct foo { ... };
+    if (consume(TK_SEMI)) {
+      node = new_node(ND_DECL);
+      set_loc(node, start);
+      return node;
+    }
+
     Token* tok = consume_ident();
     if (!tok) {
       error("変数名がありません");
     }
 
-    LVar* lvar = calloc(1, sizeof(LVar));
-    lvar->next = locals;
-    lvar->name = tok->str;
-    lvar->len = tok->len;
-
-    // 配列だった時: int a[10]など
-    if (consume("[")) {
-      Type* array_type = calloc(1, sizeof(Type));
-      array_type->ty = ARRAY;
-      array_type->array_size = expect_number();
-      array_type->ptr_to = typ;  // 配列の要素型
-      typ = array_type;
-      expect("]");
-    }
-
-    lvar->type = typ;
+    typ = array_suffix(typ);
 
-    // オフセットを計算
-    if (locals) {
-      if (typ->ty == ARRAY) {
-        // 配列の場合: 配列サイズ × 要素のサイズ
-        lvar->offset = locals->offset + typ->array_size * size_of(typ->ptr_to);
-      } else {
-        // スカラー変数：型のサイズを使う（ただし最低8バイト確保）
-        int var_size = size_of(typ);
-        if (var_size < 8) var_size = 8;  // スタックアライメントのため
-        lvar->offset = locals->offset + var_size;
-      }
-    } else {
+    // 初期化子。大きさが省略された配列の大きさを決めてから変数を作る
+    Node** init = NULL;
+    int init_len = 0;
+    Node* scalar_init = NULL;
+    if (consume(TK_ASSIGN)) {
       if (typ->ty == ARRAY) {
-        // 配列の場合: 配列サイズ × 要素のサイズ
-        lvar->offset = typ->array_size * size_of(typ->ptr_to);
+        init = initializer(typ, &init_len);
+        if (!typ->array_size) typ->array_size = init_len;
       } else {
-        // スカラー変数：型のサイズを使う（ただし最低8バイト確保）
-        int var_size = size_of(typ);
-        if (var_size < 8) var_size = 8;  // スタックアライメントのため
-        lvar->offset = var_size;
+        scalar_init = assign();
       }
     }
-    locals = lvar;
 
-    expect(";");
-    // 変数宣言は式として値を返さないので空のノードを返す
-    Node* node = new_node(ND_DECL);
-    node->offset = lvar->offset;
-    node->type = lvar->type;
+    LVar* lvar = new_lvar(tok, typ);
+    expect(TK_SEMI);
+
+    Node* var = new_node(ND_LVAR);
+    set_loc(var, tok);
+    var->offset = lvar->offset;
+    var->type = lvar->type;
+    if (scalar_init) {
+      node = new_assign(var, scalar_init);
+    } else if (init) {
+      node = local_array_init(var, init, init_len);
+    } else {
+      // 変数宣言は式として値を返さないので空のノードを返す
+      node = new_node(ND_DECL);
+      node->offset = lvar->offset;
+      node->type = lvar->type;
+    }
+    set_loc(node, start);
     return node;
   }
 
   // 通常の式文
   node = expr();
-  expect(";");
+  expect(TK_SEMI);
+  set_loc(node, start);
   return node;
 }
 
-Node* add_str_to_vec() {
-  Node* node = calloc(1, sizeof(Node));
-  node->kind = ND_STR;
+// 登録済みの文字列リテラルを探す。なければNULLを返す
+Str_vec* find_str(char* p, int len) {
+  for (Str_vec* str = ctx->strings; str; str = str->next)
+    if (str->len == len && !memcmp(str->str, p, len)) return str;
+  return NULL;
+}
 
-  // 文字列リテラルをvectorに追加
-  Str_vec* str = calloc(1, sizeof(Str_vec));
-  str->str = strndup(token->str, token->len);
-  str->len = token->len;
-  str->label = label_number++;
-  str->next = strings;
-  strings = str;
+Node* add_str_to_vec() {
+  Node* node = new_node(ND_STR);
+
+  // 同じ内容の文字列リテラルは1つのラベルを共有する
+  Str_vec* str = find_str(tok_str(peek(0)), peek(0)->len);
+  if (!str) {
+    // 文字列リテラルをvectorに追加
+    str = calloc(1, sizeof(Str_vec));
+    str->str = strndup(tok_str(peek(0)), peek(0)->len);
+    str->len = peek(0)->len;
+    str->label = ctx->label_number++;
+    str->next = ctx->strings;
+    ctx->strings = str;
+  }
 
   node->str_label = str->label;
 
   // 文字列リテラルの型は char* (char へのポインタ)
-  Type* ptr_type = calloc(1, sizeof(Type));
-  ptr_type->ty = PTR;
-  Type* char_type = calloc(1, sizeof(Type));
-  char_type->ty = CHAR;
-  ptr_type->ptr_to = char_type;
-  node->type = ptr_type;
-
-  token = token->next;
+  node->type = new_type(PTR, new_type(CHAR, NULL));
+
+  ctx->pos++;
   return node;
 }
 
+// 括弧はoperand()で扱う
 Node* primary() {
-  // 次のトークンが"("なら、"(" expr ")"のはず
-  if (consume("(")) {
-    Node* node = expr();
-    expect(")");
-    return node;
-  }
-
   // 文字列リテラル
-  if (token->kind == TK_STR) {
+  if (peek(0)->kind == TK_STR) {
     return add_str_to_vec();
   }
 
   Token* tok = consume_ident();
   if (tok) {
-    Node* node = calloc(1, sizeof(Node));
-
     // 関数呼び出しだった場合
-    if (consume("(")) {
-      node->kind = ND_CALL;
-      node->funcname = strndup(tok->str, tok->len);
-      // node->type->ty = INT;
+    if (consume(TK_LPAREN)) {
+      Node* node = new_node(ND_CALL);
+      set_loc(node, tok);
+      node->funcname = arena_alloc(tok->len + 1);
+      memcpy(node->funcname, tok_str(tok), tok->len);
+      // memset/memcpyは、同じ名前の関数が定義されていなければ
+      // __builtin_memset/__builtin_memcpyとして扱い、コード生成で展開する
+      Node* fn = find_func(node->funcname);
+      if (!fn && (!strcmp(node->funcname, "memset") ||
+                  !strcmp(node->funcname, "memcpy"))) {
+        char* name = arena_alloc(tok->len + sizeof("__builtin_"));
+        sprintf(name, "__builtin_%s", node->funcname);
+        node->funcname = name;
+      }
+      // 定義済みの関数なら戻り値の型、そうでなければintとみなす。
+      // memsetとmemcpyは書き込み先のアドレスを返す
+      if (fn)
+        node->type = fn->type;
+      else if (!strcmp(node->funcname, "__builtin_memset") ||
+               !strcmp(node->funcname, "__builtin_memcpy"))
+        node->type = new_type(PTR, new_type(CHAR, NULL));
+      else
+        node->type = new_type(INT, NULL);
       Vector* args = new_vector();
 
       // 引数がある時
-      if (!consume(")")) {
+      if (!consume(TK_RPAREN)) {
         vec_push(args, expr());
-        while (consume(",")) {
+        while (consume(TK_COMMA)) {
           vec_push(args, expr());
         }
-        expect(")");
+        expect(TK_RPAREN);
       }
       node->stmts = args->data;
       node->stmts_len = args->len;
-      free(args);
       return node;
 
     } else {
       // 変数の場合
       LVar* lvar = find_lvar(tok);
       GVar* gvar = find_gvar(tok);
+      if (!lvar && !gvar) error_at(tok_str(tok), "変数が宣言されていません");
 
+      Node* node = new_node(lvar ? ND_LVAR : ND_GVAR);
+      set_loc(node, tok);
       if (lvar) {
-        node->kind = ND_LVAR;
         node->offset = lvar->offset;
         node->type = lvar->type;
-      } else if (gvar) {
-        node->kind = ND_GVAR;
-        node->funcname =
-            strndup(gvar->name, gvar->len);  // グローバル変数名を保存
+      } else {
+        node->funcname = gvar->name;  // グローバル変数名を保存
         node->offset = gvar->offset;
         node->type = gvar->type;
-      } else {
-        error("変数が宣言されていません");
       }
 
       // 配列アクセス: a[i]
-      if (consume("[")) {
+      if (consume(TK_LBRACKET)) {
         Node* index = expr();
-        expect("]");
+        expect(TK_RBRACKET);
 
         // 配列アクセスはポインタ演算として扱う (a[i] は *(a + i) と同じ)
-        Node* array_addr = calloc(1, sizeof(Node));
+        Node* array_addr = new_node(lvar ? ND_LVAR : ND_GVAR);
+        set_loc(array_addr, tok);
         if (lvar) {
-          array_addr->kind = ND_LVAR;
           array_addr->offset = lvar->offset;
           array_addr->type = lvar->type;
         } else {
-          array_addr->kind = ND_GVAR;
-          array_addr->funcname = strndup(gvar->name, gvar->len);
+          array_addr->funcname = gvar->name;
           array_addr->offset = gvar->offset;
           array_addr->type = gvar->type;
         }
 
-        Node* addr = new_binary(ND_ADD, array_addr, index);
-        // 型の伝播：ポインタ型として設定
-        Type* var_type = lvar ? lvar->type : gvar->type;
-        if (var_type->ty == ARRAY && var_type->ptr_to) {
-          Type* ptr_type = calloc(1, sizeof(Type));
-          ptr_type->ty = PTR;
-          ptr_type->ptr_to = var_type->ptr_to;
-          addr->type = ptr_type;
-        }
-
+        Node* addr = new_add(array_addr, index);
         Node* deref = new_node(ND_DEREF);
         deref->lhs = addr;
-        if (var_type->ty == ARRAY && var_type->ptr_to) {
-          deref->type = var_type->ptr_to;
-        }
+        if (addr->type->ptr_to) deref->type = addr->type->ptr_to;
         return deref;
       }
       return node;
@@ -558,156 +1020,294 @@ Node* primary() {
   return node;
 }
 
-Node* mul() {
-  Node* node = unary();
+// 比較演算のノードを作る。比較の結果はINT型
+Node* new_compare(NodeKind kind, Node* lhs, Node* rhs) {
+  Node* node = new_binary(kind, lhs, rhs);
+  node->type = new_type(INT, NULL);
+  return node;
+}
+
+// 論理演算のノードを作る。結果は0か1のINT型
+Node* new_logical(NodeKind kind, Node* lhs, Node* rhs) {
+  Node* node = new_binary(kind, lhs, rhs);
+  node->type = new_type(INT, NULL);
+  return node;
+}
+
+Node* expr() { return assign(); }
 
+// 二項演算子の表。トークンの種類で引き、precがPREC_NONEなら二項演算子
+// ではない。演算子を増やすときは、ここに優先順位と作るノードを足す
+BinOp binops[TK_DOT + 1] = {
+    [TK_ASSIGN] = {PREC_ASSIGN, ND_ASSIGN},
+    [TK_ADD_ASSIGN] = {PREC_ASSIGN, ND_ADD_ASSIGN},
+    [TK_SUB_ASSIGN] = {PREC_ASSIGN, ND_SUB_ASSIGN},
+    [TK_MUL_ASSIGN] = {PREC_ASSIGN, ND_MUL_ASSIGN},
+    [TK_DIV_ASSIGN] = {PREC_ASSIGN, ND_DIV_ASSIGN},
+    [TK_LOGOR] = {PREC_LOGOR, ND_LOGOR},
+    [TK_LOGAND] = {PREC_LOGAND, ND_LOGAND},
+    [TK_EQ] = {PREC_EQUALITY, ND_EQ},
+    [TK_NE] = {PREC_EQUALITY, ND_NE},
+    [TK_LT] = {PREC_RELATIONAL, ND_LT},
+    [TK_LE] = {PREC_RELATIONAL, ND_LE},
+    [TK_GT] = {PREC_RELATIONAL, ND_LT, true},
+    [TK_GE] = {PREC_RELATIONAL, ND_LE, true},
+    [TK_PLUS] = {PREC_ADD, ND_ADD},
+    [TK_MINUS] = {PREC_ADD, ND_SUB},
+    [TK_STAR] = {PREC_MUL, ND_MUL},
+    [TK_SLASH] = {PREC_MUL, ND_DIV},
+};
+
+// 式を演算子の優先順位で解析する。
+// 開き括弧と前置の単項演算子も演算子のスタックに積むので、
+// 括弧が深く入れ子になっても再帰しない。
+// 引数や添字の中の式は、外側の式のスタックの上に積んで解析する
+Node* assign() {
+  int base = ctx->nops;
+  vec_push(ctx->operands, operand());
   for (;;) {
-    if (consume("*")) {
-      Node* rhs = unary();
-      node = new_binary(ND_MUL, node, rhs);
-      // 乗算・除算の結果はINT型
-      if (node->lhs->type && node->rhs->type) {
-        Type* int_type = calloc(1, sizeof(Type));
-        int_type->ty = INT;
-        node->type = int_type;
-      }
-    } else if (consume("/")) {
-      Node* rhs = unary();
-      node = new_binary(ND_DIV, node, rhs);
-      // 乗算・除算の結果はINT型
-      if (node->lhs->type && node->rhs->type) {
-        Type* int_type = calloc(1, sizeof(Type));
-        int_type->ty = INT;
-        node->type = int_type;
+    BinOp* op = &binops[peek(0)->kind];
+    if (op->prec != PREC_NONE) {
+      // 代入は右結合なので、同じ優先順位の演算子はまだまとめない
+      reduce(base, op->prec == PREC_ASSIGN ? op->prec + 1 : op->prec);
+      push_op(peek(0)->kind, op->prec);
+      ctx->pos++;
+      vec_push(ctx->operands, operand());
+      continue;
+    }
+
+    reduce(base, PREC_ASSIGN);
+    if (ctx->nops == base) break;
+
+    // 括弧の終わり。括弧の中の式には後置の演算子が付く
+    expect(TK_RPAREN);
+    ctx->nops--;
+    Vector* v = ctx->operands;
+    v->data[v->len - 1] = postfix(v->data[v->len - 1]);
+  }
+  return ctx->operands->data[--ctx->operands->len];
+}
+
+// 被演算子を1つ読む。その前の開き括弧と前置の単項演算子は
+// 演算子のスタックに積む
+Node* operand() {
+  for (;;) {
+    TokenKind kind = peek(0)->kind;
+    if (consume_sizeof()) {
+      // sizeof(型名)
+      int pos = ctx->pos;
+      if (consume(TK_LPAREN) && is_typename()) {
+        Type* type = consume_type();
+        expect(TK_RPAREN);
+        return new_node_num(size_of(type));
       }
+      ctx->pos = pos;
+      push_op(kind, PREC_UNARY);
+    } else if (consume(TK_LPAREN)) {
+      push_op(kind, PREC_NONE);
+    } else if (kind == TK_INC || kind == TK_DEC || kind == TK_PLUS ||
+               kind == TK_MINUS || kind == TK_NOT || kind == TK_STAR ||
+               kind == TK_AMP) {
+      ctx->pos++;
+      push_op(kind, PREC_UNARY);
     } else {
-      return node;
+      return postfix(primary());
     }
   }
 }
 
-Node* equality() {
-  Node* node = relational();
-  for (;;) {
-    if (consume("=="))
-      node = new_binary(ND_EQ, node, relational());
-    else if (consume("!="))
-      node = new_binary(ND_NE, node, relational());
+// 演算子をスタックに積む。演算子は読み終えていること
+void push_op(TokenKind op, int prec) {
+  if (ctx->nops == ctx->ops_cap) {
+    ctx->ops_cap = ctx->ops_cap ? ctx->ops_cap * 2 : 16;
+    ctx->ops = realloc(ctx->ops, ctx->ops_cap * sizeof(ExprOp));
+  }
+  ctx->ops[ctx->nops++] = (ExprOp){op, prec, peek(0)};
+}
+
+// スタックのbaseより上にある、優先順位がprec以上の演算子を
+// 被演算子と合わせてノードにする
+void reduce(int base, int prec) {
+  Vector* v = ctx->operands;
+  while (ctx->nops > base && ctx->ops[ctx->nops - 1].prec >= prec) {
+    ExprOp op = ctx->ops[--ctx->nops];
+    Node* rhs = v->data[--v->len];
+    if (op.prec == PREC_UNARY)
+      v->data[v->len++] = new_unary(op.op, rhs, op.tok);
     else
+      v->data[v->len - 1] =
+          new_binop(op.op, v->data[v->len - 1], rhs, op.tok);
+  }
+}
+
+// 前置の単項演算子のノードを作る。tokは被演算子の先頭のトークン
+Node* new_unary(TokenKind op, Node* lhs, Token* tok) {
+  Node* node;
+  if ((op == TK_PLUS || op == TK_MINUS || op == TK_NOT) &&
+      is_struct(lhs->type))
+    error_at(tok_str(tok), "構造体には演算できません");
+  switch (op) {
+    case TK_SIZEOF:
+      if (!lhs->type) error("sizeofの中身の型が分かりません");
+      return new_node_num(size_of(lhs->type));
+    case TK_INC:
+      return new_assign_op(ND_ADD_ASSIGN, lhs, new_node_num(1));
+    case TK_DEC:
+      return new_assign_op(ND_SUB_ASSIGN, lhs, new_node_num(1));
+    case TK_PLUS:
+      return lhs;
+    case TK_MINUS: {
+      Node* zero = new_node_num(0);
+      set_loc(zero, tok);
+      node = new_binary(ND_SUB, zero, lhs);
+      node->type = new_type(INT, NULL);
+      return node;
+    }
+    case TK_NOT:
+      node = new_node(ND_NOT);
+      set_loc(node, tok);
+      node->lhs = lhs;
+      node->type = new_type(INT, NULL);
+      return node;
+    case TK_STAR:
+      node = new_node(ND_DEREF);
+      set_loc(node, tok);
+      node->lhs = lhs;
+      // *演算子の結果は、ポインタが指す型になる
+      if (is_pointer(lhs->type)) node->type = lhs->type->ptr_to;
+      return node;
+    default:
+      // &演算子の結果はポインタ型になる
+      node = new_node(ND_ADDR);
+      set_loc(node, tok);
+      node->lhs = lhs;
+      if (lhs->type) node->type = new_type(PTR, lhs->type);
       return node;
   }
 }
 
-Node* relational() {
-  Node* node = add();
+// 二項演算子のノードを作る
+Node* new_binop(TokenKind op, Node* lhs, Node* rhs, Token* tok) {
+  BinOp* b = &binops[op];
+  // 構造体は代入でまとめてコピーできるが、演算の対象にはならない
+  if (b->kind != ND_ASSIGN && (is_struct(lhs->type) || is_struct(rhs->type)))
+    error_at(tok_str(tok), "構造体には演算できません");
+  switch (b->kind) {
+    case ND_ASSIGN:
+      return new_assign(lhs, rhs);
+    case ND_ADD_ASSIGN:
+    case ND_SUB_ASSIGN:
+    case ND_MUL_ASSIGN:
+    case ND_DIV_ASSIGN:
+      return new_assign_op(b->kind, lhs, rhs);
+    case ND_LOGAND:
+    case ND_LOGOR:
+      return new_logical(b->kind, lhs, rhs);
+    case ND_ADD:
+      return new_add(lhs, rhs);
+    case ND_SUB:
+      return new_sub(lhs, rhs);
+    default:
+      // 比較と乗算・除算の結果はINT型
+      if (b->swap) return new_compare(b->kind, rhs, lhs);
+      return new_compare(b->kind, lhs, rhs);
+  }
+}
+
+Node* new_assign(Node* lhs, Node* rhs) {
+  Node* node = new_binary(ND_ASSIGN, lhs, rhs);
+  node->type = lhs->type;
+  // 構造体は同じ型どうしでだけ代入できる
+  bool lstruct = lhs->type && lhs->type->ty == STRUCT;
+  bool rstruct = rhs->type && rhs->type->ty == STRUCT;
+  if ((lstruct || rstruct) && lhs->type != rhs->type)
+    error_at(tok_str(peek(0)), "構造体の型が一致しません");
+  return node;
+}
+
+// 複合代入と++/--のノードを作る。左辺のアドレスは一度だけ計算する。
+// ポインタの足し引きでは、右辺に掛ける要素サイズをコード生成で扱う
+Node* new_assign_op(NodeKind kind, Node* lhs, Node* rhs) {
+  if (lhs->kind != ND_LVAR && lhs->kind != ND_GVAR &&
+      lhs->kind != ND_DEREF && lhs->kind != ND_MEMBER)
+    error_at(tok_str(peek(0)),
+             "代入の左辺値が変数でもポインタでもメンバでもありません");
+  if (lhs->type && lhs->type->ty == ARRAY)
+    error_at(tok_str(peek(0)), "配列には代入できません");
+  if (lhs->type && lhs->type->ty == STRUCT)
+    error_at(tok_str(peek(0)), "構造体には演算できません");
+  if (is_pointer(lhs->type) &&
+      (kind == ND_MUL_ASSIGN || kind == ND_DIV_ASSIGN))
+    error_at(tok_str(peek(0)), "ポインタに掛け算や割り算はできません");
+  Node* node = new_binary(kind, lhs, rhs);
+  node->type = lhs->type;
+  return node;
+}
+
+// nodeに続く後置の演算子を読む。添字、構造体のメンバ（.と->）、++と--。
+// ++と--の値は変更前の値になる
+Node* postfix(Node* node) {
   for (;;) {
-    if (consume("<="))
-      node = new_binary(ND_LE, node, add());
-    else if (consume("<"))
-      node = new_binary(ND_LT, node, add());
-    else if (consume(">="))
-      node = new_binary(ND_LE, add(), node);
-    else if (consume(">"))
-      node = new_binary(ND_LT, add(), node);
+    if (consume(TK_LBRACKET)) {
+      // メンバの配列など、変数名以外への添字も*(a + i)として扱う
+      Node* addr = new_add(node, expr());
+      expect(TK_RBRACKET);
+      node = new_node(ND_DEREF);
+      node->lhs = addr;
+      node->type = addr->type ? addr->type->ptr_to : NULL;
+    } else if (consume(TK_DOT)) {
+      node = struct_ref(node);
+    } else if (consume(TK_ARROW)) {
+      Node* deref = new_node(ND_DEREF);
+      deref->lhs = node;
+      if (is_pointer(node->type)) deref->type = node->type->ptr_to;
+      node = struct_ref(deref);
+    } else if (consume(TK_INC))
+      node = new_assign_op(ND_POST_INC, node, new_node_num(1));
+    else if (consume(TK_DEC))
+      node = new_assign_op(ND_POST_DEC, node, new_node_num(1));
     else
       return node;
   }
 }
-Node* expr() { return assign(); }
 
-Node* assign() {
-  Node* node = equality();
-  if (consume("=")) node = new_binary(ND_ASSIGN, node, assign());
-  return node;
+// ポインタ（配列）型かどうか
+bool is_pointer(Type* type) {
+  return type && (type->ty == PTR || type->ty == ARRAY);
 }
 
-Node* unary() {
-  if (consume_sizeof()) {
-    Node* lhs = unary();
+// 構造体型かどうか
+bool is_struct(Type* type) { return type && type->ty == STRUCT; }
 
-    // sizeofの中身がポインタなら8を返す
-    if (lhs->type && lhs->type->ty == PTR) {
-      return new_node_num(8);
+// 大きさの決まっていない型かどうか。
+// 定義の途中の構造体と、要素数を省略した配列
+bool is_incomplete(Type* type) {
+  for (; type->ty == ARRAY; type = type->ptr_to)
+    if (!type->array_size) return true;
+  return type->ty == STRUCT && type->incomplete;
+}
 
-      // 中身がintなら4を返す
-    } else if (lhs->type && lhs->type->ty == INT) {
-      return new_node_num(4);
-    }
-    error("sizeofの中身がポインタでもint型でもありません");
-  }
-  if (consume("+")) return primary();
-  if (consume("-")) return new_binary(ND_SUB, new_node_num(0), primary());
-  if (consume("*")) {
-    Node* node = new_node(ND_DEREF);
-    node->lhs = unary();
-    // *演算子の結果は、ポインタが指す型になる
-    if (node->lhs->type && node->lhs->type->ty == PTR) {
-      node->type = node->lhs->type->ptr_to;
-    }
-    return node;
-  }
-  if (consume("&")) {
-    Node* node = new_node(ND_ADDR);
-    node->lhs = unary();
-    // &演算子の結果はポインタ型になる
-    if (node->lhs->type) {
-      Type* ptr_type = calloc(1, sizeof(Type));
-      ptr_type->ty = PTR;
-
-      // &a (aはint) なら、 &aの型は pointer → int (intのポインタ)
-      ptr_type->ptr_to = node->lhs->type;
-      node->type = ptr_type;
-    }
-    return node;
-  }
-  return primary();
+// lhs + rhs のノードを作る。
+// ポインタ + 整数はポインタ型、それ以外はINT型
+Node* new_add(Node* lhs, Node* rhs) {
+  Node* node = new_binary(ND_ADD, lhs, rhs);
+  if (is_pointer(lhs->type))
+    node->type = new_type(PTR, lhs->type->ptr_to);
+  else if (is_pointer(rhs->type))
+    node->type = new_type(PTR, rhs->type->ptr_to);
+  else
+    node->type = new_type(INT, NULL);
+  return node;
 }
 
-Node* add() {
-  Node* node = mul();
-  for (;;) {
-    if (consume("+")) {
-      Node* rhs = mul();
-      node = new_binary(ND_ADD, node, rhs);
-
-      // 型推論: ポインタ演算があればポインタ型、それ以外はINT型
-      // 配列型もポインタとして扱う
-      int lhs_is_ptr = (node->lhs->type && (node->lhs->type->ty == PTR ||
-                                            node->lhs->type->ty == ARRAY));
-      int rhs_is_ptr = (node->rhs->type && (node->rhs->type->ty == PTR ||
-                                            node->rhs->type->ty == ARRAY));
-
-      if (lhs_is_ptr || rhs_is_ptr) {
-        Type* ptr_type = calloc(1, sizeof(Type));
-        ptr_type->ty = PTR;
-        node->type = ptr_type;
-      } else if (node->lhs->type && node->rhs->type) {
-        Type* int_type = calloc(1, sizeof(Type));
-        int_type->ty = INT;
-        node->type = int_type;
-      }
-    } else if (consume("-")) {
-      Node* rhs = mul();
-      node = new_binary(ND_SUB, node, rhs);
-
-      // 引き算の時も同様
-      // 配列型もポインタとして扱う
-      int lhs_is_ptr = (node->lhs->type && (node->lhs->type->ty == PTR ||
-                                            node->lhs->type->ty == ARRAY));
-      int rhs_is_ptr = (node->rhs->type && (node->rhs->type->ty == PTR ||
-                                            node->rhs->type->ty == ARRAY));
-
-      if (lhs_is_ptr || rhs_is_ptr) {
-        Type* ptr_type = calloc(1, sizeof(Type));
-        ptr_type->ty = PTR;
-        node->type = ptr_type;
-      } else if (node->lhs->type && node->rhs->type) {
-        Type* int_type = calloc(1, sizeof(Type));
-        int_type->ty = INT;
-        node->type = int_type;
-      }
-    } else {
-      return node;
-    }
-  }
+// lhs - rhs のノードを作る。
+// ポインタ - 整数はポインタ型、ポインタ - ポインタ（要素数の差）はINT型
+Node* new_sub(Node* lhs, Node* rhs) {
+  Node* node = new_binary(ND_SUB, lhs, rhs);
+  if (is_pointer(lhs->type) && !is_pointer(rhs->type))
+    node->type = new_type(PTR, lhs->type->ptr_to);
+  else
+    node->type = new_type(INT, NULL);
+  return node;
 }
+
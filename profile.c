@@ -0,0 +1,59 @@
+#include <errno.h>
+
+#include "9cc.h"
+
+// 関数本体から番号がidのifを探す
+Node* find_branch(Node* node, int id) {
+  if (!node) return NULL;
+  if (node->kind == ND_IF && node->branch_id == id) return node;
+
+  Node* found = find_branch(node->lhs, id);
+  if (!found) found = find_branch(node->rhs, id);
+  if (found || is_compact(node->kind)) return found;
+
+  Node* kids[] = {node->cond, node->then, node->els,
+                  node->init, node->inc,  node->body};
+  for (int i = 0; i < sizeof(kids) / sizeof(*kids); i++) {
+    found = find_branch(kids[i], id);
+    if (found) return found;
+  }
+  if (node->kind == ND_BLOCK) {
+    for (int i = 0; i < node->stmts_len; i++) {
+      found = find_branch(node->stmts[i], id);
+      if (found) return found;
+    }
+  }
+  return NULL;
+}
+
+// -finstrumentで書き出した計測結果を読み、関数とifのノードに回数を付ける。
+// 形式はgen_prof_dump()を参照。ソースの変更で見つからなくなった関数や
+// ifの行は読み飛ばす
+void read_profile(char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) error("cannot open %s: %s", path, strerror(errno));
+
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    char name[128];
+    long a, b;
+    if (sscanf(line, "%127s %ld %ld", name, &a, &b) != 3)
+      error("%s: 計測結果の形式が正しくありません: %s", path, line);
+
+    char* at = strchr(name, '@');
+    if (at) *at = '\0';
+    Node* func = find_func(name);
+    if (!func) continue;
+
+    if (!at) {
+      func->count = a;
+      continue;
+    }
+    Node* node = find_branch(func->body, atoi(at + 1));
+    if (!node) continue;
+    node->total = a;
+    node->count = b;
+  }
+  fclose(fp);
+  ctx->has_profile = true;
+}
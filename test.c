@@ -23,6 +23,12 @@ int run_code(const char* code, int wrap_main) {
   }
   fclose(fp);
 
+  // JIT=1のときはリンクせずにメモリ上で実行する
+  if (getenv("JIT")) {
+    int status = system("./9cc --run tmp.c ./tmp2.so 2>/dev/null");
+    return WEXITSTATUS(status);
+  }
+
   // 9ccでコンパイル
   if (system("./9cc tmp.c > tmp.s 2>/dev/null") != 0) {
     fprintf(stderr, "Compilation failed: %s\n", code);
@@ -119,6 +125,168 @@ void assert_file(int expected, const char* filename) {
   }
 }
 
+// -finstrumentでコンパイルして実行し、終了コードと計測結果の行を確かめる
+void assert_instrument(int expected, const char* code, const char* line) {
+  test_count++;
+  int actual = -1;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  if (system("./9cc -finstrument tmp.c > tmp.s 2>/dev/null") != 0) {
+    fprintf(stderr, "Compilation failed: %s\n", code);
+  } else if (system("cc -target x86_64-apple-darwin -o tmp.x tmp.s "
+                    "2>/dev/null") != 0) {
+    fprintf(stderr, "Assembly failed: %s\n", code);
+  } else {
+    actual = WEXITSTATUS(system("./tmp.x 2>tmp.prof"));
+  }
+
+  // 計測結果にlineで始まる行があるか
+  int found = 0;
+  char buf[256];
+  fp = fopen("tmp.prof", "r");
+  while (fp && fgets(buf, sizeof(buf), fp))
+    if (!strncmp(buf, line, strlen(line))) found = 1;
+  if (fp) fclose(fp);
+
+  if (actual == expected && found) {
+    printf("✓ Test %d: instrument => %d\n", test_count, actual);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: instrument => expected %d and \"%s\", but got %d\n",
+           test_count, expected, line, actual);
+    test_failed++;
+  }
+}
+
+// -finstrumentの計測結果を-fprofile-useに渡してコンパイルし直して実行する
+void assert_profile_use(int expected, const char* code) {
+  test_count++;
+  int actual = -1;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  if (system("./9cc -finstrument tmp.c > tmp.s 2>/dev/null") != 0 ||
+      system("cc -target x86_64-apple-darwin -o tmp.x tmp.s 2>/dev/null") !=
+          0 ||
+      system("./tmp.x 2>tmp.prof") == -1) {
+    fprintf(stderr, "Instrumented build failed: %s\n", code);
+  } else if (system("./9cc -fprofile-use=tmp.prof tmp.c > tmp.s "
+                    "2>/dev/null") != 0 ||
+             system("cc -target x86_64-apple-darwin -o tmp.x tmp.s "
+                    "2>/dev/null") != 0) {
+    fprintf(stderr, "Profile-guided build failed: %s\n", code);
+  } else {
+    actual = WEXITSTATUS(system("./tmp.x 2>/dev/null"));
+  }
+
+  if (actual == expected) {
+    printf("✓ Test %d: profile-use => %d\n", test_count, actual);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: profile-use => expected %d, but got %d\n",
+           test_count, expected, actual);
+    test_failed++;
+  }
+}
+
+// 生成したアセンブリにtextが含まれるか確かめる
+void assert_asm(const char* code, const char* text) {
+  test_count++;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  int found = 0;
+  if (system("./9cc tmp.c > tmp.s 2>/dev/null") == 0) {
+    char buf[256];
+    fp = fopen("tmp.s", "r");
+    while (fgets(buf, sizeof(buf), fp))
+      if (strstr(buf, text)) found = 1;
+    fclose(fp);
+  }
+
+  if (found) {
+    printf("✓ Test %d: asm contains \"%s\"\n", test_count, text);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: asm => expected \"%s\"\n", test_count, text);
+    test_failed++;
+  }
+}
+
+// コンパイルエラーになり、メッセージにtextを含むことを確かめる
+void assert_error(const char* code, const char* text) {
+  test_count++;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  int found = 0;
+  if (system("./9cc tmp.c > tmp.s 2> tmp.err") != 0) {
+    char buf[256];
+    fp = fopen("tmp.err", "r");
+    while (fgets(buf, sizeof(buf), fp))
+      if (strstr(buf, text)) found = 1;
+    fclose(fp);
+  }
+
+  if (found) {
+    printf("✓ Test %d: error contains \"%s\"\n", test_count, text);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: error => expected \"%s\"\n", test_count, text);
+    test_failed++;
+  }
+}
+
+// 組み込みのアセンブラでオブジェクトファイルを出力して実行（ELFのみ）
+void assert_object(int expected, const char* code) {
+  test_count++;
+  int actual = -1;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  if (system("./9cc -c -o tmp.o tmp.c 2>/dev/null") != 0) {
+    fprintf(stderr, "Compilation failed: %s\n", code);
+  } else if (system("cc -o tmp.x tmp.o 2>/dev/null") != 0) {
+    fprintf(stderr, "Link failed: %s\n", code);
+  } else {
+    actual = WEXITSTATUS(system("./tmp.x 2>/dev/null"));
+  }
+
+  if (actual == expected) {
+    printf("✓ Test %d: object => %d\n", test_count, actual);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: object => expected %d, but got %d\n", test_count,
+           expected, actual);
+    test_failed++;
+  }
+}
+
+// リンクせずにメモリ上で実行（ELFのみ）
+void assert_jit(int expected, const char* code) {
+  test_count++;
+  FILE* fp = fopen("tmp.c", "w");
+  fprintf(fp, "%s", code);
+  fclose(fp);
+
+  int actual = WEXITSTATUS(system("./9cc --run tmp.c ./tmp2.so 2>/dev/null"));
+
+  if (actual == expected) {
+    printf("✓ Test %d: jit => %d\n", test_count, actual);
+    test_passed++;
+  } else {
+    printf("✗ Test %d: jit => expected %d, but got %d\n", test_count,
+           expected, actual);
+    test_failed++;
+  }
+}
+
 void setup_tmp2() {
   FILE* fp = fopen("tmp2.c", "w");
   if (!fp) {
@@ -136,6 +304,13 @@ void setup_tmp2() {
           "    int_ptr[2] = c;\n"
           "    int_ptr[3] = d;\n"
           "    *p = int_ptr;\n"
+          "}\n"
+          "int sum8(int a, int b, int c, int d, int e, int f, int g, int h) {\n"
+          "    return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * "
+          "h;\n"
+          "}\n"
+          "int is_aligned() {\n"
+          "    return ((long)__builtin_frame_address(0) & 15) == 0;\n"
           "}\n");
   fclose(fp);
 
@@ -143,6 +318,12 @@ void setup_tmp2() {
     fprintf(stderr, "Failed to compile tmp2.c\n");
     exit(1);
   }
+#ifdef __linux__
+  if (system("cc -shared -fPIC -o tmp2.so tmp2.c") != 0) {
+    fprintf(stderr, "Failed to build tmp2.so\n");
+    exit(1);
+  }
+#endif
 }
 
 int main() {
@@ -179,7 +360,7 @@ int main() {
   assert_code(4, "int a; a = 2; if (a == 2) { a = 3; a = a + 1;  return a; }");
 
   // ポインタ
-  assert_code(3, "int x; x = 3; int y; y = 5; int z; z = &y + 2; return *z;");
+  assert_code(3, "int x; x = 3; int y; y = 5; int *z; z = &y + 1; return *z;");
   assert_code(3, "int x; int *y; y = &x; *y = 3; return x;");
 
   // ポインタ演算
@@ -249,6 +430,353 @@ int main() {
   assert_code(2, "int a; a = 2; /* a = 3; */ return a;");
   assert_code(2, "int a; a = 2;\n/* a = 3;\n*/\nreturn a;");
 
+  // 共通部分式
+  assert_code(10, "int a[3]; a[1] = 5; int i; i = 1; return a[i] + a[i];");
+  assert_code(12,
+              "int a[4]; int i; i = 2; a[i] = 3; a[i] = a[i] * a[i] + a[i]; "
+              "return a[i];");
+  assert_code(7,
+              "int a[2]; int *p; p = a; a[0] = 1; int x; x = a[0] + 1; *p = "
+              "5; return a[0] + x;");
+  assert_code(7,
+              "int *p; alloc4(&p, 1, 2, 4, 8); int x; x = *(p+1); alloc4(&p, "
+              "3, 5, 7, 9); return x + *(p+1);");
+  assert_program(5,
+                 "int g; int set() { g = 3; return 0; } int main() { g = 1; "
+                 "int x; x = g + 1; set(); return x + g; }");
+  char* block = calloc(1, 65536);
+  strcpy(block, "int a[3]; int i; int s; i = 1; a[i] = 7; s = 0; ");
+  for (int i = 0; i < 1500; i++)
+    strcat(block, "s = s + a[i] * a[i] - a[i] * a[i] + 1; ");
+  strcat(block, "return s - 1400;");
+  assert_code(100, block);
+  free(block);
+
+  // ループ不変式の移動
+  assert_code(60,
+              "int n; n = 5; int i; int s; s = 0; for (i = 0; i < n * 2; i = "
+              "i + 1) s = s + n * 2 - 4; return s;");
+  assert_program(3,
+                 "int g; int bump() { g = g - 1; return 0; } int main() { g = "
+                 "0; int i; i = 0; while (i < g + 5) { bump(); i = i + 1; } "
+                 "return i; }");
+  assert_code(4,
+              "int a[4]; a[0] = 4; int *p; p = a; int i; int s; s = 0; for (i "
+              "= 0; i < 3; i = i + 1) { s = s + *p; *p = 0; } return s;");
+  assert_code(
+      0, "int *p; p = 0; int i; i = 0; while (i < 0) { i = i + *p; } return i;");
+
+  // ループの回転と入れ子の制御構文
+  assert_code(12,
+              "int i; int j; int s; s = 0; for (i = 0; i < 3; i = i + 1) for "
+              "(j = 0; j < 4; j = j + 1) s = s + 1; return s;");
+  assert_code(3,
+              "int i; int j; int s; s = 0; for (i = 0; i < 3; i = i + 1) { j = "
+              "0; while (j < 4) { if (j == 1) s = s + 1; j = j + 1; } } return "
+              "s;");
+  assert_code(5, "int i; i = 5; while (i < 3) i = i + 1; return i;");
+  assert_code(7, "int i; i = 0; for (;;) { if (i == 7) return i; i = i + 1; }");
+
+  // ベクトル化
+  assert_code(144,
+              "int a[40]; int b[40]; int c[40]; int i; for (i = 0; i < 40; i = "
+              "i + 1) { b[i] = i; c[i] = 3 * i; } for (i = 1; i < 37; i = i + "
+              "1) a[i] = b[i] + c[i]; return a[36];");
+  assert_code(48,
+              "char x[60]; char y[60]; int i; for (i = 0; i < 60; i = i + 1) { "
+              "x[i] = i; y[i] = 2; } for (i = 0; i <= 50; i = i + 1) x[i] = "
+              "x[i] - y[i]; return x[50] + x[51] - 51;");
+  assert_code(100,
+              "int a[60]; int *p; int *q; int i; for (i = 0; i < 60; i = i + "
+              "1) a[i] = i; p = a; q = a + 1; for (i = 0; i < 50; i = i + 1) "
+              "q[i] = p[i] + 2; return a[50];");
+  assert_code(7,
+              "char x[40]; int i; int k; k = 7; for (i = 0; i < 40; i = i + 1) "
+              "x[i] = k; return x[33];");
+
+  // 32ビットのint
+  assert_code(1, "int x; x = 2147483647; x = x + 1; return x < 0;");
+  assert_code(7, "int x; int y; x = -7; y = 2; return x / y + 10;");
+  assert_code(3, "int a[4]; int *p; int *q; p = a; q = a + 3; return q - p;");
+  assert_program(4,
+                 "int g; int h; int main() { g = -1; h = 5; return g + h; }");
+  assert_program(7,
+                 "int f(int a, char b) { return a + b; } int main() { return "
+                 "f(-3, 10); }");
+
+  // .bssのグローバル変数と文字列リテラルの共有
+  assert_program(3,
+                 "int g[100000]; int main() { g[99999] = 3; return g[0] + "
+                 "g[99999]; }");
+  assert_code(1, "char *a; char *b; a = \"abc\"; b = \"abc\"; return a == b;");
+  assert_code(199,
+              "char *s; char *t; s = \"ab\\0cd\"; t = \"ab\"; "
+              "return s[3] + s[4] + t[1] - 98;");
+  assert_asm("int main() { char *s; s = \"a\\0b\"; return s[2]; }",
+             ".section .rodata\n");
+  assert_program(13,
+                 "int gs; int rax[3]; int fs = 2; int *rbx = &fs; int *es[] = "
+                 "{&gs, rax}; int main() { gs = 1; rax[2] = 4; *rbx += gs; "
+                 "return gs + rax[2] + fs + *es[0] + es[1][2]; }");
+
+  // switch文とbreak
+  assert_code(25,
+              "int x; int r; x = 2; r = 0; switch (x) { case 0: r = 10; break; "
+              "case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; "
+              "break; default: r = 99; } return r;");
+  assert_code(99,
+              "int x; int r; x = 4; r = 0; switch (x) { case 0: r = 10; break; "
+              "case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; "
+              "break; default: r = 99; } return r;");
+  assert_code(6,
+              "int x; x = 20000; switch (x) { case -100: return 1; case 7: "
+              "return 2; case 1000: return 3; case 50: return 4; case 3000: "
+              "return 5; case 20000: return 6; } return 0;");
+  assert_code(3,
+              "int x; x = -1; switch (x) { case -2: return 2; case -1: return "
+              "3; case 0: return 4; case 1: return 5; } return 0;");
+  assert_code(21,
+              "int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { if (i == "
+              "7) break; s = s + i; } return s;");
+  assert_asm(
+      "int main() { switch (1) { case 0: case 1: case 2: case 3: return 1; } "
+      "return 0; }",
+      ".Ltable");
+
+  // 論理演算子
+  assert_code(1, "return 2 && 3;");
+  assert_code(0, "return 2 && 0;");
+  assert_code(1, "return 0 || 3;");
+  assert_code(0, "return 0 || 0;");
+  assert_code(1, "return !0;");
+  assert_code(0, "return !7;");
+  assert_code(1, "int a; a = 1; return a < 2 && a > 0 || a == 5;");
+  assert_code(7,
+              "int *p; p = 0; if (p && *p) return 1; if (!p || *p == 0) "
+              "return 7; return 2;");
+  assert_program(1,
+                 "int n; int f() { n = n + 1; return 1; } int main() { if (0 "
+                 "&& f()) return 9; if (1 || f()) return n + 1; return 0; }");
+  assert_code(12,
+              "int a; int b; int c; a = 3; b = 4; c = 0; return (c && a * b) "
+              "+ a * b;");
+
+  // 複合代入とインクリメント・デクリメント
+  assert_code(45,
+              "int i; int s; s = 0; for (i = 0; i < 10; i++) s += i; return "
+              "s;");
+  assert_code(10,
+              "int i; int s; s = 20; for (i = 10; i > 0; --i) s -= 1; s *= 2; "
+              "s /= 2; return s;");
+  assert_code(5, "int i; int j; i = 5; j = i++; return j;");
+  assert_code(6, "int i; int j; i = 5; j = ++i; return j;");
+  assert_code(4, "int i; int j; i = 5; j = i--; return i;");
+  assert_code(2,
+              "int a[3]; int *p; a[0] = 1; a[1] = 2; a[2] = 4; p = a; p++; "
+              "return *p++;");
+  assert_code(8,
+              "int a[3]; int i; a[1] = 3; i = 1; a[i++] += 5; return a[1] + i "
+              "- 2;");
+  assert_program(10,
+                 "int g; int main() { g = 5; g += 3; g++; ++g; return g; }");
+  assert_asm("int main() { int i; for (i = 0; i < 3; i++) {} return i; }",
+             "add DWORD PTR [rbp-");
+
+  // 構造体
+  assert_code(12,
+              "struct pt { char c; int x; char d; }; struct pt a; return "
+              "sizeof(a);");
+  assert_code(16, "struct pt { char c; int *p; }; return sizeof(struct pt);");
+  assert_code(3,
+              "struct pt { char c; int x; }; struct pt a; struct pt *p; p = "
+              "&a; p->x = 3; return a.x;");
+  assert_code(7,
+              "struct pt { char c; int x; }; struct pt a; struct pt *p; p = "
+              "&a; a.x = 4; a.c = 1; p->x++; --p->x; p->x /= 2; a.c += 6; "
+              "a.x *= 3; a.x--; p->x++; return a.x + a.c - 6;");
+  assert_code(31,
+              "struct pt { char c; int x; }; struct pt a[4]; int i; for (i = "
+              "0; i < 4; i++) { a[i].x = i * 10; a[i].c = i; } return a[3].x + "
+              "a[1].c;");
+  assert_code(14,
+              "struct pt { char c; int x; char d; }; struct pt a; struct pt b; "
+              "a.c = 1; a.x = 10; a.d = 3; b = a; return b.c + b.x + b.d;");
+  assert_code(58,
+              "struct pt { int v[30]; char t; }; struct pt a; struct pt b; int "
+              "i; for (i = 0; i < 30; i++) a.v[i] = i; a.t = 29; b = a; return "
+              "b.v[29] + b.t;");
+  assert_program(7,
+                 "struct node { int val; struct node *next; }; int sum(struct "
+                 "node *n) { int s; s = 0; while (n) { s += n->val; n = "
+                 "n->next; } return s; } int main() { struct node a; struct "
+                 "node b; struct node c; a.val = 1; b.val = 2; c.val = 4; "
+                 "a.next = &b; b.next = &c; c.next = 0; return sum(&a); }");
+  assert_asm(
+      "struct pt { int v[8]; }; int main() { struct pt a; struct pt b; b = a; "
+      "return 0; }",
+      "movdqu");
+  assert_asm(
+      "struct pt { int v[40]; }; int main() { struct pt a; struct pt b; b = "
+      "a; return 0; }",
+      "rep movsb");
+  assert_error("struct s { int a; struct s x; }; int main() { return 0; }",
+               "メンバの型が不完全です");
+  assert_error(
+      "int main() { struct pt { int x; }; struct pt a; return a * 2; }",
+      "構造体には演算できません");
+
+  // memsetとmemcpyの展開
+  assert_code(1,
+              "char a[40]; int i; for (i = 0; i < 40; i++) a[i] = 7; memset(a, "
+              "0, 37); return a[36] == 0 && a[37] == 7;");
+  assert_code(9,
+              "char a[300]; int v; v = 9; memset(a, v, 250); return a[249];");
+  assert_code(4,
+              "char a[10]; int n; n = 10; __builtin_memset(a, 4, n); return "
+              "a[9];");
+  assert_code(5,
+              "int a[100]; int b[100]; b[99] = 5; __builtin_memcpy(a, b, "
+              "sizeof(b)); return a[99];");
+  assert_asm("int main() { int a[10]; memset(a, 0, sizeof(a)); return a[3]; }",
+             "pxor xmm0, xmm0");
+  assert_asm("int main() { char a[200]; memset(a, 1, 200); return a[3]; }",
+             "rep stosb");
+  // 同じ名前の関数が定義されていれば、その関数を呼ぶ
+  assert_program(6,
+                 "int memset(int a, int b, int c) { return a + b + c; } "
+                 "int main() { return memset(1, 2, 3); }");
+
+  // 初期化子
+  assert_code(60, "int a[4] = {10, 20, 30}; return a[0] + a[1] + a[2] + a[3];");
+  assert_code(4, "char s[] = \"abc\"; return sizeof(s) + s[3];");
+  assert_code(11,
+              "int x = 2; int a[3] = {x, x + 1, x * 2}; return a[0] + a[1] + "
+              "a[2] + 2;");
+  assert_program(98,
+                 "char *names[] = {\"a\", \"bc\"}; char s[] = \"xy\"; char *p "
+                 "= \"hi\"; int main() { return names[1][0] + s[2] + (p[1] == "
+                 "105) - 1; }");
+  assert_asm("int a[3] = {1, 2, 3}; int main() { return a[0]; }", ".long 3");
+  assert_asm("int main() { int a[4] = {1, 2, 3}; return a[0]; }", ".L.data");
+  // エラーは問題の箇所を"^"で指し示す
+  assert_error("int x[3]; int y = 1 + x; int main() { return 0; }",
+               "^ 初期化子が定数式ではありません");
+  assert_error("int main() { return 1 + zz; }", "^ 変数が宣言されていません");
+
+  // 引数のレジスタ渡しと7個以上の引数
+  assert_code(204, "return sum8(1, 2, 3, 4, 5, 6, 7, 8);");
+  assert_code(54,
+              "int a[3]; a[1] = 5; int i; i = 1; "
+              "return sum8(a[i] + 1, 0, 0, 0, 0, 0, 0, a[i] + 1);");
+  assert_program(19,
+                 "int f(int a, int b, int c, int d, int e, int f, int g, int "
+                 "h) { return a - b + c - d + e - f + g * h; } int main() { "
+                 "int x; x = 2; return f(x, 1, x * 3, 2, 5, 3, x + 1, f(1, 1, "
+                 "1, 1, 1, 1, 2, 2)); }");
+  assert_program(7,
+                 "int sum(int n, int *p) { int s; s = 0; while (n--) s += "
+                 "*p++; return s; } int main() { int a[3]; a[0] = 1; a[1] = 2; "
+                 "a[2] = 4; return sum(3, a); }");
+  assert_program(9,
+                 "int f(int a) { int *p; p = &a; *p = 9; return a; } int "
+                 "main() { return f(1); }");
+  assert_asm("int f(int a) { return a; } int main() { return f(1); }",
+             "mov ebx, edi");
+  assert_asm("int f(int a) { return a; } int main() { return f(1); }",
+             "mov rdi, 1");
+
+  // 関数呼び出しでのスタックの16バイト境界
+  assert_code(2, "int x; x = 1; return x + is_aligned();");
+  assert_code(3, "return 1 + (1 + is_aligned());");
+  assert_code(204, "return 0 + sum8(1, 2, 3, 4, 5, 6, 7, is_aligned() * 8);");
+  assert_asm("int main() { return 0; }", ".p2align 4");
+  assert_asm(
+      "int f() { return 1; } int main() { int x; x = 1; return x + f(); }",
+      "sub rsp, 8");
+
+  // 演算子の優先順位と深い括弧の入れ子
+  assert_code(1, "return 2 * -3 + 10 > 3 == 1;");
+  assert_code(1, "int a[2]; a[1] = 5; return -(a)[1] + 6;");
+  assert_code(4, "int x; int *p; p = &x; *p = 3; "
+                 "return !(x - 3) + *&x + sizeof -x - sizeof(int);");
+  char* deep = calloc(1, 100100);
+  strcpy(deep, "return ");
+  memset(deep + 7, '(', 50000);
+  strcat(deep, "1");
+  memset(deep + 50008, ')', 50000);
+  strcat(deep, ";");
+  assert_code(1, deep);
+  free(deep);
+
+  // 関数ごとの出力と構文木の解放
+  assert_program(3,
+                 "char *s() { return \"ab\"; } char *t() { return \"cd\"; } "
+                 "int main() { return s()[1] + t()[0] - 194; }");
+  char* many = calloc(1, 8192);
+  for (int i = 1; i <= 150; i++)
+    sprintf(many + strlen(many), "int f%d() { return %d; } ", i, i);
+  strcat(many, "int main() { return f150() - f1(); }");
+  assert_program(149, many);
+  free(many);
+
+  assert_instrument(55,
+                    "int fib(int n) { if (n < 2) return n; return fib(n - 1) "
+                    "+ fib(n - 2); } int main() { return fib(10); }",
+                    "fib\t177\t");
+  assert_instrument(30,
+                    "int sq(int x) { return x * x; } int main() { int i; int "
+                    "s; s = 0; for (i = 0; i < 5; i = i + 1) s = s + sq(i); "
+                    "return s; }",
+                    "sq\t5\t");
+  assert_instrument(3,
+                    "int main(int argc, char **argv) { return argc + (argv[0] "
+                    "!= 0) + 1; }",
+                    "main\t1\t");
+
+  // 計測結果を使った関数と分岐の配置
+  assert_profile_use(3,
+                     "int never() { return 9; } int main() { int i; int s; s "
+                     "= 0; for (i = 0; i < 100; i = i + 1) if (i == 50) s = s "
+                     "+ 3; if (s == 0) return never(); return s; }");
+  assert_profile_use(12,
+                     "int f(int x) { if (x > 90) return 1; else return 0; } "
+                     "int main() { int i; int s; s = 0; for (i = 0; i < 100; "
+                     "i = i + 1) s = s + f(i); return s + 3; }");
+
+  // ソースの行番号（.fileと.loc）
+  assert_asm("int main() {\n  int a;\n  a = 3;\n  return a;\n}\n",
+             ".file 1 \"tmp.c\"");
+  assert_asm("int main() {\n  int a;\n  a = 3;\n  return a;\n}\n",
+             ".loc 1 3 3\n");
+  assert_asm(
+      "int f(int x) {\n  while (x < 10)\n    x = x + 1;\n  return x;\n}",
+      ".loc 1 3 5\n");
+
+#ifdef __linux__
+  // 組み込みのアセンブラ
+  assert_object(7,
+                "int f(int a, char b) { return a + b; } int main() { return "
+                "f(-3, 10); }");
+  assert_object(103,
+                "int g[100]; char *s; int main() { s = \"abcdef\"; g[99] = 3; "
+                "return g[99] + s[3] - g[0]; }");
+  assert_object(55,
+                "int fib(int n) { if (n < 2) return n; return fib(n - 1) + "
+                "fib(n - 2); } int main() { int i; int s; s = 0; for (i = 0; i "
+                "< 10; i = i + 1) s = fib(i + 1); return s; }");
+
+  // メモリ上での実行
+  assert_jit(55,
+             "int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n "
+             "- 2); } int main() { return fib(10); }");
+  assert_jit(6,
+             "int main() { int *p; alloc4(&p, 1, 2, 4, 8); return *(p + 1) + "
+             "*(p + 2); }");
+  assert_jit(3,
+             "int g[100]; int main() { g[99] = 3; return printf(\"%d\\n\", "
+             "g[0] + g[99]) + g[0] + 1; }");
+#endif
+
   // フィボナッチ数列（ファイルから）
   assert_file(55, "fib.txt");
 
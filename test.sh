@@ -11,9 +11,18 @@ void alloc4(int **p, int a, int b, int c, int d) {
  
     *p = int_ptr;
 }
+int sum8(int a, int b, int c, int d, int e, int f, int g, int h) {
+    return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+int is_aligned() {
+    return ((long)__builtin_frame_address(0) & 15) == 0;
+}
 EOF
 
 cc -target x86_64-apple-darwin -c tmp2.c -o tmp2.o
+if [ "$(uname)" = Linux ]; then
+  cc -shared -fPIC -o tmp2.so tmp2.c
+fi
 
 assert() {
   expected="$1"
@@ -24,9 +33,14 @@ assert() {
 
   # 一時ファイルに書き込む
   echo "$input" > tmp.c
-  ./9cc tmp.c > tmp.s
-  cc -target x86_64-apple-darwin -o tmp.x tmp.s tmp2.o
-  ./tmp.x
+  if [ "$JIT" = 1 ]; then
+    # JIT=1 ./test.sh ならリンクせずにメモリ上で実行する
+    ./9cc --run tmp.c ./tmp2.so
+  else
+    ./9cc tmp.c > tmp.s
+    cc -target x86_64-apple-darwin -o tmp.x tmp.s tmp2.o
+    ./tmp.x
+  fi
   actual="$?"
 
   if [ "$actual" = "$expected" ]; then
@@ -44,9 +58,14 @@ assert_program() {
 
   # 一時ファイルに書き込む
   echo "$input" > tmp.c
-  ./9cc tmp.c > tmp.s
-  cc -target x86_64-apple-darwin -o tmp.x tmp.s tmp2.o
-  ./tmp.x
+  if [ "$JIT" = 1 ]; then
+    # JIT=1 ./test.sh ならリンクせずにメモリ上で実行する
+    ./9cc --run tmp.c ./tmp2.so
+  else
+    ./9cc tmp.c > tmp.s
+    cc -target x86_64-apple-darwin -o tmp.x tmp.s tmp2.o
+    ./tmp.x
+  fi
   actual="$?"
 
   if [ "$actual" = "$expected" ]; then
@@ -57,6 +76,20 @@ assert_program() {
   fi
 }
 
+# コンパイルエラーになり、メッセージにmessageを含むことを確かめる
+assert_error() {
+  message="$1"
+  input="$2"
+
+  echo "$input" > tmp.c
+  if ./9cc tmp.c > tmp.s 2> tmp.err || ! grep -q "$message" tmp.err; then
+    echo "$input => error \"$message\" expected, but got:"
+    cat tmp.err
+    exit 1
+  fi
+  echo "$input => $message"
+}
+
 assert 0 "return 0;"
 assert 42 "42;"
 assert 21 "5+20-4;"
@@ -109,7 +142,7 @@ cc -target x86_64-apple-darwin -o tmp.x tmp.s
 ./tmp.x
 
 # *と&
-assert 3 "int x; x = 3; int y; y = 5; int z; z = &y + 2; return *z;";
+assert 3 "int x; x = 3; int y; y = 5; int *z; z = &y + 1; return *z;";
 
 # ポインタ型
 assert 3 "int x; int *y; y = &x; *y = 3; return x;";
@@ -168,5 +201,273 @@ assert 2  'int a; a = 2;
 */
 return a;'
 
+# 共通部分式
+assert 10 'int a[3]; a[1] = 5; int i; i = 1; return a[i] + a[i];'
+assert 12 'int a[4]; int i; i = 2; a[i] = 3; a[i] = a[i] * a[i] + a[i]; return a[i];'
+assert 7 'int a[2]; int *p; p = a; a[0] = 1; int x; x = a[0] + 1; *p = 5; return a[0] + x;'
+assert 7 'int *p; alloc4(&p, 1, 2, 4, 8); int x; x = *(p+1); alloc4(&p, 3, 5, 7, 9); return x + *(p+1);'
+assert_program 5 'int g; int set() { g = 3; return 0; } int main() { g = 1; int x; x = g + 1; set(); return x + g; }'
+# 長い基本ブロックは途中で区切って置き換える
+assert 100 "int a[3]; int i; int s; i = 1; a[i] = 7; s = 0; $(printf 's = s + a[i] * a[i] - a[i] * a[i] + 1; %.0s' $(seq 1500))return s - 1400;"
+
+# ループ不変式の移動
+assert 60 'int n; n = 5; int i; int s; s = 0; for (i = 0; i < n * 2; i = i + 1) s = s + n * 2 - 4; return s;'
+assert_program 3 'int g; int bump() { g = g - 1; return 0; } int main() { g = 0; int i; i = 0; while (i < g + 5) { bump(); i = i + 1; } return i; }'
+assert 4 'int a[4]; a[0] = 4; int *p; p = a; int i; int s; s = 0; for (i = 0; i < 3; i = i + 1) { s = s + *p; *p = 0; } return s;'
+assert 0 'int *p; p = 0; int i; i = 0; while (i < 0) { i = i + *p; } return i;'
+
+# ループの回転と入れ子の制御構文
+assert 12 'int i; int j; int s; s = 0; for (i = 0; i < 3; i = i + 1) for (j = 0; j < 4; j = j + 1) s = s + 1; return s;'
+assert 3 'int i; int j; int s; s = 0; for (i = 0; i < 3; i = i + 1) { j = 0; while (j < 4) { if (j == 1) s = s + 1; j = j + 1; } } return s;'
+assert 5 'int i; i = 5; while (i < 3) i = i + 1; return i;'
+assert 7 'int i; i = 0; for (;;) { if (i == 7) return i; i = i + 1; }'
+
+# ベクトル化
+assert 144 'int a[40]; int b[40]; int c[40]; int i; for (i = 0; i < 40; i = i + 1) { b[i] = i; c[i] = 3 * i; } for (i = 1; i < 37; i = i + 1) a[i] = b[i] + c[i]; return a[36];'
+assert 48 'char x[60]; char y[60]; int i; for (i = 0; i < 60; i = i + 1) { x[i] = i; y[i] = 2; } for (i = 0; i <= 50; i = i + 1) x[i] = x[i] - y[i]; return x[50] + x[51] - 51;'
+assert 100 'int a[60]; int *p; int *q; int i; for (i = 0; i < 60; i = i + 1) a[i] = i; p = a; q = a + 1; for (i = 0; i < 50; i = i + 1) q[i] = p[i] + 2; return a[50];'
+assert 7 'char x[40]; int i; int k; k = 7; for (i = 0; i < 40; i = i + 1) x[i] = k; return x[33];'
+
+# 32ビットのint
+assert 1 'int x; x = 2147483647; x = x + 1; return x < 0;'
+assert 7 'int x; int y; x = -7; y = 2; return x / y + 10;'
+assert 3 'int a[4]; int *p; int *q; p = a; q = a + 3; return q - p;'
+assert_program 4 'int g; int h; int main() { g = -1; h = 5; return g + h; }'
+assert_program 7 'int f(int a, char b) { return a + b; } int main() { return f(-3, 10); }'
+
+# .bssのグローバル変数と文字列リテラルの共有
+assert_program 3 'int g[100000]; int main() { g[99999] = 3; return g[0] + g[99999]; }'
+assert 1 'char *a; char *b; a = "abc"; b = "abc"; return a == b;'
+assert 199 'char *s; char *t; s = "ab\0cd"; t = "ab"; return s[3] + s[4] + t[1] - 98;'
+assert_program 13 'int gs; int rax[3]; int fs = 2; int *rbx = &fs; int *es[] = {&gs, rax}; int main() { gs = 1; rax[2] = 4; *rbx += gs; return gs + rax[2] + fs + *es[0] + es[1][2]; }'
+
+# switch文とbreak
+assert 25 'int x; int r; x = 2; r = 0; switch (x) { case 0: r = 10; break; case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; break; default: r = 99; } return r;'
+assert 99 'int x; int r; x = 4; r = 0; switch (x) { case 0: r = 10; break; case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; break; default: r = 99; } return r;'
+assert 6 'int x; x = 20000; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50: return 4; case 3000: return 5; case 20000: return 6; } return 0;'
+assert 0 'int x; x = 8; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50: return 4; case 3000: return 5; case 20000: return 6; } return 0;'
+assert 3 'int x; x = -1; switch (x) { case -2: return 2; case -1: return 3; case 0: return 4; case 1: return 5; } return 0;'
+assert 21 'int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { if (i == 7) break; s = s + i; } return s;'
+assert 5 'int i; i = 0; while (1) { switch (i) { case 5: break; default: i = i + 1; } if (i == 5) break; } return i;'
+
+# 論理演算子
+assert 1 'return 2 && 3;'
+assert 0 'return 2 && 0;'
+assert 1 'return 0 || 3;'
+assert 0 'return 0 || 0;'
+assert 1 'return !0;'
+assert 0 'return !7;'
+assert 1 'int a; a = 1; return a < 2 && a > 0 || a == 5;'
+assert 7 'int *p; p = 0; if (p && *p) return 1; if (!p || *p == 0) return 7; return 2;'
+assert_program 1 'int n; int f() { n = n + 1; return 1; } int main() { if (0 && f()) return 9; if (1 || f()) return n + 1; return 0; }'
+assert 12 'int a; int b; int c; a = 3; b = 4; c = 0; return (c && a * b) + a * b;'
+# 複合代入とインクリメント・デクリメント
+assert 45 'int i; int s; s = 0; for (i = 0; i < 10; i++) s += i; return s;'
+assert 10 'int i; int s; s = 20; for (i = 10; i > 0; --i) s -= 1; s *= 2; s /= 2; return s;'
+assert 5 'int i; int j; i = 5; j = i++; return j;'
+assert 6 'int i; int j; i = 5; j = ++i; return j;'
+assert 4 'int i; int j; i = 5; j = i--; return i;'
+assert 4 'int i; int j; i = 5; j = --i; return j;'
+assert 4 'int a[3]; int *p; a[0] = 1; a[1] = 2; a[2] = 4; p = a; p += 2; return *p;'
+assert 2 'int a[3]; int *p; a[0] = 1; a[1] = 2; a[2] = 4; p = a; p++; return *p++;'
+assert 8 'int a[3]; int i; a[1] = 3; i = 1; a[i++] += 5; return a[1] + i - 2;'
+assert 1 'char c; c = 127; c += 1; return c == -128;'
+assert_program 10 'int g; int main() { g = 5; g += 3; g++; ++g; return g; }'
+# 構造体
+assert 12 'struct pt { char c; int x; char d; }; struct pt a; return sizeof(a);'
+assert 16 'struct pt { char c; int *p; }; return sizeof(struct pt);'
+assert 7 'struct pt { int x; int y; }; struct pt a; a.x = 3; a.y = 4; return a.x + a.y;'
+assert 3 'struct pt { char c; int x; }; struct pt a; struct pt *p; p = &a; p->x = 3; return a.x;'
+assert 20 'struct pt { char c; int x; }; struct pt a; a.x = 3; a.c = 1; a.x += 2; a.x++; ++a.x; a.x *= 3; a.c -= 2; return a.x + a.c;'
+assert 8 'struct pt { char c; int x; }; struct pt a; struct pt *p; p = &a; a.x = 4; a.c = 1; p->x++; --p->x; p->x /= 2; p->c += 6; p->x++; return p->x + p->c - 2;'
+assert 31 'struct pt { char c; int x; }; struct pt a[4]; int i; for (i = 0; i < 4; i++) { a[i].x = i * 10; a[i].c = i; } return a[3].x + a[1].c;'
+assert 9 'struct pt { int v[3]; }; struct pt a; a.v[2] = 9; return a.v[2];'
+assert 14 'struct pt { char c; int x; char d; }; struct pt a; struct pt b; a.c = 1; a.x = 10; a.d = 3; b = a; return b.c + b.x + b.d;'
+assert 58 'struct pt { int v[30]; char t; }; struct pt a; struct pt b; int i; for (i = 0; i < 30; i++) a.v[i] = i; a.t = 29; b = a; return b.v[29] + b.t;'
+assert_program 7 'struct node { int val; struct node *next; }; int sum(struct node *n) { int s; s = 0; while (n) { s += n->val; n = n->next; } return s; } int main() { struct node a; struct node b; struct node c; a.val = 1; b.val = 2; c.val = 4; a.next = &b; b.next = &c; c.next = 0; return sum(&a); }'
+assert_program 5 'struct pt { int x; int y; }; struct pt g; int main() { g.y = 5; return g.x + g.y; }'
+assert 13 'struct pt { int n; int v[]; }; int a[4]; struct pt *p; p = a; p->n = 3; p->v[2] = 10; return p->n + a[3] + sizeof(struct pt) - 4;'
+assert_error 'メンバの型が不完全です' 'struct s { int a; struct s x; }; int main() { return 0; }'
+assert_error 'メンバの型が不完全です' 'struct s { int v[]; int a; }; int main() { return 0; }'
+assert_error '構造体には演算できません' 'int main() { struct pt { int x; }; struct pt a; struct pt b; return a == b; }'
+assert_error '構造体には演算できません' 'int main() { struct pt { int x; }; struct pt a; return a + 1; }'
+assert_error '構造体には演算できません' 'int main() { struct pt { int x; }; struct pt a; return !a; }'
+# memsetとmemcpyの展開
+assert 1 'char a[40]; int i; for (i = 0; i < 40; i++) a[i] = 7; memset(a, 0, 37); return a[36] == 0 && a[37] == 7;'
+assert 3 'int a[50]; __builtin_memset(a, 0, sizeof(a)); a[49] += 3; return a[49] + a[0];'
+assert 9 'char a[300]; int v; v = 9; memset(a, v, 250); return a[249];'
+assert 4 'char a[10]; int n; n = 10; __builtin_memset(a, 4, n); return a[9];'
+assert 5 'int a[10]; int b[10]; b[9] = 5; memcpy(a, b, 40); return a[9];'
+assert 5 'int a[100]; int b[100]; b[99] = 5; __builtin_memcpy(a, b, sizeof(b)); return a[99];'
+assert_program 6 'int memset(int a, int b, int c) { return a + b + c; } int main() { return memset(1, 2, 3); }'
+assert_program 9 'int memcpy(int *a, int *b, int c) { return *a + *b + c; } int main() { int x; x = 3; return memcpy(&x, &x, 3); }'
+# 初期化子
+assert 3 'int x = 3; return x;'
+assert 60 'int a[4] = {10, 20, 30}; return a[0] + a[1] + a[2] + a[3];'
+assert 20 'int a[] = {1, 2, 3, 4, 5,}; return sizeof(a);'
+assert 4 'char s[] = "abc"; return sizeof(s) + s[3];'
+assert 11 'int x = 2; int a[3] = {x, x + 1, x * 2}; return a[0] + a[1] + a[2] + 2;'
+assert_program 27 'int g = 3; int a[5] = {1, 2 * 3, 4}; int *p = &g; int main() { return g + a[1] + a[4] + *p + sizeof(a) - 2 * 4 + a[2] - 1; }'
+assert_program 98 'char *names[] = {"a", "bc"}; char s[] = "xy"; char *p = "hi"; int main() { return names[1][0] + s[2] + (p[1] == 105) - 1; }'
+assert_error '\^ 初期化子が定数式ではありません' 'int x; int y = x; int main() { return 0; }'
+assert_error '\^ 初期化子が定数式ではありません' 'int x[3]; int y = 1 + x; int main() { return 0; }'
+assert_error '\^ 変数が宣言されていません' 'int main() { return 1 + zz; }'
+# 引数のレジスタ渡しと7個以上の引数
+assert 204 'return sum8(1, 2, 3, 4, 5, 6, 7, 8);'
+assert 204 'int x; int a[2]; x = 3; a[1] = 7; return sum8(1, x - 1, x, sum8(0, 0, 0, 2, 0, 0, 0, 0) - 4, 5, 6, a[1], 8);'
+assert 45 'int a[3]; a[1] = 5; int i; i = 1; return sum8(a[i], 0, 0, 0, 0, 0, 0, a[i]);'
+assert 54 'int a[3]; a[1] = 5; int i; i = 1; return sum8(a[i] + 1, 0, 0, 0, 0, 0, 0, a[i] + 1);'
+assert_program 19 'int f(int a, int b, int c, int d, int e, int f, int g, int h) { return a - b + c - d + e - f + g * h; } int main() { int x; x = 2; return f(x, 1, x * 3, 2, 5, 3, x + 1, f(1, 1, 1, 1, 1, 1, 2, 2)); }'
+assert_program 7 'int sum(int n, int *p) { int s; s = 0; while (n--) s += *p++; return s; } int main() { int a[3]; a[0] = 1; a[1] = 2; a[2] = 4; return sum(3, a); }'
+assert_program 12 'int f(int a, int b) { a *= 3; a /= b; b++; return a + b; } int main() { return f(10, 4); }'
+assert_program 9 'int f(int a) { int *p; p = &a; *p = 9; return a; } int main() { return f(1); }'
+assert_program 55 'int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { return fib(10); }'
+# 関数呼び出しでのスタックの16バイト境界
+assert 1 'return is_aligned();'
+assert 2 'int x; x = 1; return x + is_aligned();'
+assert 3 'return 1 + (1 + is_aligned());'
+assert 197 'int x; x = 1; return x + sum8(1, 2, 3, 4, 5, 6, 7, is_aligned() * 8) - 8;'
+assert 204 'return 0 + sum8(1, 2, 3, 4, 5, 6, 7, is_aligned() * 8);'
+assert_program 1 'int f(int a) { return a * is_aligned(); } int main() { int x; x = 1; return x * f(1); }'
+# 演算子の優先順位と深い括弧の入れ子
+assert 1 'return 2 * -3 + 10 > 3 == 1;'
+assert 7 'int a; int b; a = b = 3; return a + b * 2 - (a > b || b >= a) * 2;'
+assert 1 'int a[2]; a[1] = 5; return -(a)[1] + 6;'
+assert 4 'int x; int *p; p = &x; *p = 3; return !(x - 3) + *&x + sizeof -x - sizeof(int);'
+assert 1 "return $(printf '(%.0s' $(seq 50000))1$(printf ')%.0s' $(seq 50000));"
+# 関数ごとの出力と構文木の解放
+assert_program 3 'char *s() { return "ab"; } char *t() { return "cd"; } int main() { return s()[1] + t()[0] - 194; }'
+assert_program 7 'struct p { int x; struct p *next; }; int f() { struct p a; a.x = 3; return a.x; } int g; int h() { struct p b; b.next = &b; b.x = 4; return b.next->x + g; } int main() { g = 0; return f() + h(); }'
+assert_program 149 "$(for i in $(seq 150); do printf 'int f%d() { return %d; } ' $i $i; done)int main() { return f150() - f1(); }"
+# 関数ごとの呼び出し回数とサイクル数の計測
+echo 'int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { return fib(10); }' > tmp.c
+./9cc -finstrument tmp.c > tmp.s
+cc -target x86_64-apple-darwin -o tmp.x tmp.s
+./tmp.x 2> tmp.prof
+actual="$?"
+if [ "$actual" != 55 ] || ! grep -q "^fib	177	" tmp.prof || ! grep -q "^main	1	" tmp.prof; then
+  echo "-finstrument => 55 and fib 177 calls expected, but got $actual"
+  cat tmp.prof
+  exit 1
+fi
+echo "-finstrument => $actual"
+cat tmp.prof
+
+# 引数を受け取るmain。atexitの登録で引数のレジスタを壊さない
+echo 'int main(int argc, char **argv) { return argc + argv[1][0] - 97; }' > tmp.c
+./9cc -finstrument tmp.c > tmp.s
+cc -target x86_64-apple-darwin -o tmp.x tmp.s
+./tmp.x abc 2> tmp.prof
+actual="$?"
+if [ "$actual" != 2 ] || ! grep -q "^main	1	" tmp.prof; then
+  echo "-finstrument with argc/argv => 2 expected, but got $actual"
+  exit 1
+fi
+echo "-finstrument with argc/argv => $actual"
+
+# 計測結果を使った関数と分岐の配置
+echo 'int never() { return 9; } int main() { int i; int s; s = 0; for (i = 0; i < 100; i = i + 1) if (i == 50) s = s + 3; if (s == 0) return never(); return s; }' > tmp.c
+./9cc -finstrument tmp.c > tmp.s
+cc -target x86_64-apple-darwin -o tmp.x tmp.s
+./tmp.x 2> tmp.prof
+./9cc -fprofile-use=tmp.prof tmp.c > tmp.s
+cc -target x86_64-apple-darwin -o tmp.x tmp.s
+./tmp.x
+actual="$?"
+if [ "$actual" != 3 ] || ! grep -q "^main@0	100	1" tmp.prof || ! grep -q "^\.Lcold" tmp.s; then
+  echo "-fprofile-use => 3 expected, but got $actual"
+  exit 1
+fi
+echo "-fprofile-use => $actual"
+
+# ソースの行番号（.fileと.loc）
+printf 'int main() {\n  int a;\n  a = 3;\n  return a;\n}\n' > tmp.c
+./9cc tmp.c > tmp.s
+if ! grep -q '^\.file 1 "tmp.c"' tmp.s || ! grep -q '\.loc 1 3 3$' tmp.s || ! grep -q '\.loc 1 4 3$' tmp.s; then
+  echo ".file/.loc expected, but got:"
+  grep '\.file\|\.loc' tmp.s
+  exit 1
+fi
+echo ".file/.loc => OK"
+
+# 組み込みのアセンブラ（ELFのみ）
+assert_object() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" > tmp.c
+  ./9cc -c -o tmp.o tmp.c
+  cc -o tmp.x tmp.o
+  ./tmp.x
+  actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $actual"
+  else
+    echo "$input => $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+if [ "$(uname)" = Linux ]; then
+  assert_object 7 'int f(int a, char b) { return a + b; } int main() { return f(-3, 10); }'
+  assert_object 103 'int g[100]; char *s; int main() { s = "abcdef"; g[99] = 3; return g[99] + s[3] - g[0]; }'
+  assert_object 55 'int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) s = fib(i + 1); return s; }'
+fi
+
+# メモリ上での実行（ELFのみ）
+assert_jit() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" > tmp.c
+  ./9cc --run tmp.c ./tmp2.so
+  actual="$?"
+
+  if [ "$actual" = "$expected" ]; then
+    echo "$input => $actual"
+  else
+    echo "$input => $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+if [ "$(uname)" = Linux ]; then
+  assert_jit 55 'int fib(int n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } int main() { return fib(10); }'
+  assert_jit 6 'int main() { int *p; alloc4(&p, 1, 2, 4, 8); return *(p + 1) + *(p + 2); }'
+  assert_jit 3 'int g[100]; int main() { g[99] = 3; return printf("%d\n", g[0] + g[99]) + g[0] + 1; }'
+fi
+
+# compile()でメモリ上のソースをコンパイルする（ELFのみ）
+# read_fileと違って末尾に改行がなく、行コメントで終わるバッファを渡す。
+# バッファの直後を読めないページにして、終端を越えて読んだら落ちるようにする
+if [ "$(uname)" = Linux ]; then
+  cat <<EOF > tmp_api.c
+#include <sys/mman.h>
+#include "9cc.h"
+int main() {
+  char code[] = "int main() { return 3; } // end";
+  char* page = mmap(NULL, 8192, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  mprotect(page + 4096, 4096, PROT_NONE);
+  char* src = page + 4096 - sizeof(code);
+  memcpy(src, code, sizeof(code));
+  char* text = compile(new_context("buf.c"), src);
+  if (!text) return 1;
+  printf("%s", text);
+  return 0;
+}
+EOF
+  cc -D_DEFAULT_SOURCE -o tmp_api tmp_api.c \
+    $(ls *.o | grep -v -e '^main\.o$' -e '^tmp') -ldl
+  rm -f tmp_api.c
+  ./tmp_api > tmp.s && cc -o tmp.x tmp.s && ./tmp.x
+  actual="$?"
+  if [ "$actual" != 3 ]; then
+    echo "compile() with a trailing line comment => 3 expected, but got $actual"
+    exit 1
+  fi
+  echo "compile() with a trailing line comment => OK"
+fi
 
 echo OK
\ No newline at end of file
@@ -1,19 +1,56 @@
 #include "9cc.h"
 
-// グローバル変数の実体
-Token* token;
-char* user_input;
-
-// 新しいトークンを作成してcurに繋げる
-Token* new_token(TokenKind kind, Token* cur, char* str, int len) {
-  Token* tok = calloc(1, sizeof(Token));
+// 新しいトークンを作成してトークンの配列の末尾に加える。
+// 配列は伸ばすときに動くので、返したポインタは次のトークンを作るまで有効
+Token* new_token(TokenKind kind, char* str, int len) {
+  if (ctx->ntokens == ctx->tokens_cap) {
+    ctx->tokens_cap = ctx->tokens_cap ? ctx->tokens_cap * 2 : 256;
+    ctx->tokens = realloc(ctx->tokens, ctx->tokens_cap * sizeof(Token));
+  }
+  Token* tok = &ctx->tokens[ctx->ntokens++];
+  *tok = (Token){0};
   tok->kind = kind;
-  tok->str = str;
+  tok->loc = str - ctx->user_input;
   tok->len = len;
-  cur->next = tok;
   return tok;
 }
 
+// 記号の種類ごとの文字列
+char* punct_str[] = {
+    [TK_EQ] = "==",
+    [TK_NE] = "!=",
+    [TK_GE] = ">=",
+    [TK_LE] = "<=",
+    [TK_LOGAND] = "&&",
+    [TK_LOGOR] = "||",
+    [TK_ADD_ASSIGN] = "+=",
+    [TK_SUB_ASSIGN] = "-=",
+    [TK_MUL_ASSIGN] = "*=",
+    [TK_DIV_ASSIGN] = "/=",
+    [TK_INC] = "++",
+    [TK_DEC] = "--",
+    [TK_ARROW] = "->",
+    [TK_COMMA] = ",",
+    [TK_PLUS] = "+",
+    [TK_MINUS] = "-",
+    [TK_STAR] = "*",
+    [TK_SLASH] = "/",
+    [TK_LPAREN] = "(",
+    [TK_RPAREN] = ")",
+    [TK_LT] = "<",
+    [TK_GT] = ">",
+    [TK_ASSIGN] = "=",
+    [TK_SEMI] = ";",
+    [TK_COLON] = ":",
+    [TK_LBRACE] = "{",
+    [TK_RBRACE] = "}",
+    [TK_AMP] = "&",
+    [TK_LBRACKET] = "[",
+    [TK_RBRACKET] = "]",
+    [TK_NOT] = "!",
+    [TK_DOT] = ".",
+};
+
 int is_alnum(char c) {
   return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') ||
          ('0' <= c && c <= '9') || (c == '_');
@@ -23,11 +60,22 @@ int is_alnum(char c) {
 // 一致していたらtrueを返す
 bool startswith(char* p, char* q) { return memcmp(p, q, strlen(q)) == 0; }
 
-// 入力文字列pをトークナイズしてそれを返す
-Token* tokenize(char* p) {
-  Token head;
-  head.next = NULL;
-  Token* cur = &head;
+// pから始まる記号の種類を返す。記号でなければ0を返す。
+// 2文字の記号が先に並んでいるので、長い方に一致する
+TokenKind read_punct(char* p) {
+  for (TokenKind kind = TK_EQ; kind <= TK_DOT; kind++) {
+    char* s = punct_str[kind];
+    if (p[0] == s[0] && (!s[1] || p[1] == s[1])) return kind;
+  }
+  return 0;
+}
+
+// 入力文字列pをトークナイズしてctx->tokensに並べる。
+// pはctx->user_inputを指していること
+void tokenize(char* p) {
+  char* start = p;
+  Token* cur;
+  ctx->ntokens = 0;
 
   while (*p) {
     // 空白文字をスキップ
@@ -39,7 +87,7 @@ Token* tokenize(char* p) {
     // 行コメントをスキップ
     if (strncmp(p, "//", 2) == 0) {
       p += 2;
-      while (*p != '\n') p++;
+      while (*p && *p != '\n') p++;
       continue;
     }
 
@@ -52,53 +100,81 @@ Token* tokenize(char* p) {
     }
 
     if (strncmp(p, "if", 2) == 0 && !is_alnum(p[2])) {
-      cur = new_token(TK_IF, cur, p, 2);
+      cur = new_token(TK_IF, p, 2);
       p += 2;
       continue;
     }
     if (strncmp(p, "while", 5) == 0 && !is_alnum(p[5])) {
-      cur = new_token(TK_WHILE, cur, p, 5);
+      cur = new_token(TK_WHILE, p, 5);
       p += 5;
       continue;
     }
     if (strncmp(p, "for", 3) == 0 && !is_alnum(p[3])) {
-      cur = new_token(TK_FOR, cur, p, 3);
+      cur = new_token(TK_FOR, p, 3);
       p += 3;
       continue;
     }
     if (strncmp(p, "return", 6) == 0 && !is_alnum(p[6])) {
-      cur = new_token(TK_RETURN, cur, p, 6);
+      cur = new_token(TK_RETURN, p, 6);
       p += 6;
       continue;
     }
     if (strncmp(p, "else", 4) == 0 && !is_alnum(p[4])) {
-      cur = new_token(TK_ELSE, cur, p, 4);
+      cur = new_token(TK_ELSE, p, 4);
+      p += 4;
+      continue;
+    }
+    if (strncmp(p, "switch", 6) == 0 && !is_alnum(p[6])) {
+      cur = new_token(TK_SWITCH, p, 6);
+      p += 6;
+      continue;
+    }
+    if (strncmp(p, "case", 4) == 0 && !is_alnum(p[4])) {
+      cur = new_token(TK_CASE, p, 4);
       p += 4;
       continue;
     }
+    if (strncmp(p, "default", 7) == 0 && !is_alnum(p[7])) {
+      cur = new_token(TK_DEFAULT, p, 7);
+      p += 7;
+      continue;
+    }
+    if (strncmp(p, "break", 5) == 0 && !is_alnum(p[5])) {
+      cur = new_token(TK_BREAK, p, 5);
+      p += 5;
+      continue;
+    }
+
+    if (strncmp(p, "struct", 6) == 0 && !is_alnum(p[6])) {
+      cur = new_token(TK_STRUCT, p, 6);
+      p += 6;
+      continue;
+    }
 
     if (strncmp(p, "int", 3) == 0 && !is_alnum(p[3])) {
-      cur = new_token(TK_INT, cur, p, 3);
+      cur = new_token(TK_INT, p, 3);
       p += 3;
       continue;
     }
 
     if (strncmp(p, "sizeof", 6) == 0 && !is_alnum(p[6])) {
-      cur = new_token(TK_SIZEOF, cur, p, 6);
+      cur = new_token(TK_SIZEOF, p, 6);
       p += 6;
       continue;
     }
 
     if (strncmp(p, "char", 4) == 0 && !is_alnum(p[4])) {
-      cur = new_token(TK_CHAR, cur, p, 4);
+      cur = new_token(TK_CHAR, p, 4);
       p += 4;
       continue;
     }
 
-    if (startswith(p, "==") || startswith(p, "!=") || startswith(p, ">=") ||
-        startswith(p, "<=")) {
-      cur = new_token(TK_RESERVED, cur, p, 2);
-      p += 2;
+    // 記号
+    TokenKind punct = read_punct(p);
+    if (punct) {
+      int len = strlen(punct_str[punct]);
+      cur = new_token(punct, p, len);
+      p += len;
       continue;
     }
 
@@ -107,39 +183,49 @@ Token* tokenize(char* p) {
       char* q = p + 1;
       while (*q != '"') {
         if (*q == '\0') {
-          error_at(p, user_input, "文字列リテラルが閉じられていません");
+          error_at(p, "文字列リテラルが閉じられていません");
         }
         q++;
       }
-      cur = new_token(TK_STR, cur, p + 1, q - p - 1);
+      cur = new_token(TK_STR, p + 1, q - p - 1);
       p = q + 1;
       continue;
     }
 
-    if (strchr(",+-*/()<>=;{}&[]", *p)) {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
-      continue;
-    }
-
     if (isdigit(*p)) {
       char* q = p;
-      cur = new_token(TK_NUM, cur, p, 0);
+      cur = new_token(TK_NUM, p, 0);
       cur->val = strtol(p, &p, 10);
       cur->len = p - q;
       continue;
     }
 
-    if ('a' <= *p && *p <= 'z') {
+    if (('a' <= *p && *p <= 'z') || *p == '_') {
       char* q = p;
       while (is_alnum(*p)) {
         p++;
       }
-      cur = new_token(TK_IDENT, cur, q, p - q);
+      cur = new_token(TK_IDENT, q, p - q);
       continue;
     }
-    error_at(p, user_input, "トークナイズできません");
+    error_at(p, "トークナイズできません");
   }
 
-  new_token(TK_EOF, cur, p, 0);
-  return head.next;
+  new_token(TK_EOF, p, 0);
+
+  // トークンに行番号と桁番号を付ける
+  int line = 1;
+  char* line_start = start;
+  char* q = start;
+  for (int i = 0; i < ctx->ntokens; i++) {
+    Token* tok = &ctx->tokens[i];
+    for (; q < start + tok->loc; q++) {
+      if (*q == '\n') {
+        line++;
+        line_start = q + 1;
+      }
+    }
+    tok->line = line;
+    tok->col = start + tok->loc - line_start + 1;
+  }
 }
@@ -3,7 +3,16 @@
 
 #include "9cc.h"
 
-char* filename;
+// エラーメッセージを報告する。コンパイル中ならメッセージをctx->errorに
+// 入れてcompile()の呼び出し元に戻り、それ以外の場合は表示して終了する
+void raise_error(char* msg) {
+  if (ctx && ctx->on_error) {
+    ctx->error = msg;
+    longjmp(*ctx->on_error, 1);
+  }
+  fputs(msg, stderr);
+  exit(1);
+}
 
 // エラーの起きた場所を報告するための関数
 // 下のようなフォーマットでエラーメッセージを表示する
@@ -13,47 +22,99 @@ char* filename;
 void error_at(char* loc, char* msg, ...) {
   // locが含まれている行の開始地点と終了地点を取得
   char* line = loc;
-  while (user_input < line && line[-1] != '\n') line--;
+  while (ctx->user_input < line && line[-1] != '\n') line--;
 
   char* end = loc;
-  while (*end != '\n') end++;
+  while (*end && *end != '\n') end++;
 
   // 見つかった行が全体の何行目なのかを調べる
   int line_num = 1;
-  for (char* p = user_input; p < line; p++)
+  for (char* p = ctx->user_input; p < line; p++)
     if (*p == '\n') line_num++;
 
   // 見つかった行を、ファイル名と行番号と一緒に表示
-  int indent = fprintf(stderr, "%s:%d: ", filename, line_num);
-  fprintf(stderr, "%.*s\n", (int)(end - line), line);
+  char* buf;
+  size_t len;
+  FILE* fp = open_memstream(&buf, &len);
+  int indent = fprintf(fp, "%s:%d: ", ctx->filename, line_num);
+  fprintf(fp, "%.*s\n", (int)(end - line), line);
 
   // エラー箇所を"^"で指し示して、エラーメッセージを表示
   int pos = loc - line + indent;
-  fprintf(stderr, "%*s", pos, "");  // pos個の空白を出力
-  fprintf(stderr, "^ %s\n", msg);
-  exit(1);
+  fprintf(fp, "%*s", pos, "");  // pos個の空白を出力
+  fprintf(fp, "^ ");
+  va_list ap;
+  va_start(ap, msg);
+  vfprintf(fp, msg, ap);
+  va_end(ap);
+  fprintf(fp, "\n");
+  fclose(fp);
+  raise_error(buf);
 }
 void error(char* fmt, ...) {
+  char* buf;
+  size_t len;
+  FILE* fp = open_memstream(&buf, &len);
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
-  exit(1);
+  vfprintf(fp, fmt, ap);
+  va_end(ap);
+  fprintf(fp, "\n");
+  fclose(fp);
+  raise_error(buf);
+}
+
+// 0で埋めた領域を確保する。ctx->use_arenaが真ならアリーナから取り、
+// arena_reset()まで解放しない。偽ならヒープから取る
+void* arena_alloc(size_t size) {
+  if (!ctx->use_arena) return calloc(1, size);
+
+  size = align_to(size, 8);
+  Arena* a = ctx->arena;
+  if (!a || a->size - a->used < size) {
+    size_t block = size > 64 * 1024 ? size : 64 * 1024;
+    a = malloc(sizeof(Arena) + block);
+    a->next = ctx->arena;
+    a->size = block;
+    a->used = 0;
+    ctx->arena = a;
+  }
+  void* p = a->data + a->used;
+  a->used += size;
+  return memset(p, 0, size);
+}
+
+// アリーナのブロックをすべて解放する。以降の確保はヒープから取る
+void arena_reset() {
+  while (ctx->arena) {
+    Arena* next = ctx->arena->next;
+    free(ctx->arena);
+    ctx->arena = next;
+  }
+  ctx->use_arena = false;
 }
 
 // Vector構造体の操作関数
 Vector* new_vector() {
-  Vector* vec = calloc(1, sizeof(Vector));
+  Vector* vec = arena_alloc(sizeof(Vector));
   vec->capacity = 8;  // 初期容量
-  vec->data = calloc(vec->capacity, sizeof(Node*));
+  vec->data = arena_alloc(vec->capacity * sizeof(Node*));
   vec->len = 0;
+  vec->in_arena = ctx->use_arena;
   return vec;
 }
 
 void vec_push(Vector* vec, Node* elem) {
   if (vec->len == vec->capacity) {
     vec->capacity *= 2;
-    vec->data = realloc(vec->data, vec->capacity * sizeof(Node*));
+    if (vec->in_arena) {
+      // 古い領域はアリーナと一緒に解放される
+      Node** data = arena_alloc(vec->capacity * sizeof(Node*));
+      memcpy(data, vec->data, vec->len * sizeof(Node*));
+      vec->data = data;
+    } else {
+      vec->data = realloc(vec->data, vec->capacity * sizeof(Node*));
+    }
   }
   vec->data[vec->len++] = elem;
 }
@@ -62,7 +123,6 @@ void vec_push(Vector* vec, Node* elem) {
 char* read_file(char* path) {
   // ファイルを開く
   FILE* fp = fopen(path, "r");
-  filename = path;
   if (!fp) error("cannot open %s: %s", path, strerror(errno));
 
   // ファイルの長さを調べる